@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define IMAGEEVO_HOST_DEVICE __host__ __device__
+#else
+#define IMAGEEVO_HOST_DEVICE
+#endif
+
+// Fixed point quadratic form of a rotated ellipse relative to its origin. A pixel (xc, yc) is covered if
+//   a * xc^2 + b * xc * yc + c * yc^2 <= f
+// and it lies inside of the bounding box [-bb, bb) in both directions. This predicate defines the coverage of the
+// CPU rasterizer and the CUDA kernels alike, floating point is only used once per ellipse to set up the form.
+//
+// With f = 2^shift each coefficient is off by at most 1/2, so the form differs from the exact one by at most
+// 3/2 * bb^2 / 2^shift inside of the box. shift is chosen as large as possible without overflowing 64 bits
+// (|a|, |c| <= 2^(shift+1) and |b| <= 2^shift), for ellipses up to 1024 pixels this moves the boundary by less
+// than 1/300 pixel.
+struct EllipseForm {
+    int64_t a = 0, b = 0, c = 0, f = -1;
+    int bb = 0;
+
+    static EllipseForm Create(int major, int minor, double angle) {
+        EllipseForm form;
+        form.bb = major > minor ? major : minor;
+        // degenerate ellipses cover no pixels
+        if (major <= 0 || minor <= 0) return form;
+
+        int bits = 0;
+        while ((int64_t(1) << bits) <= form.bb) bits++;
+        const int shift = 60 - 2 * bits > 0 ? 60 - 2 * bits : 0;
+
+        const double cos = std::cos(angle), sin = std::sin(angle);
+        const double inv_major = 1.0 / (double(major) * major), inv_minor = 1.0 / (double(minor) * minor);
+        form.a = std::llround(std::ldexp(cos * cos * inv_major + sin * sin * inv_minor, shift));
+        form.b = std::llround(std::ldexp(2.0 * cos * sin * (inv_minor - inv_major), shift));
+        form.c = std::llround(std::ldexp(sin * sin * inv_major + cos * cos * inv_minor, shift));
+        form.f = int64_t(1) << shift;
+        return form;
+    }
+
+    IMAGEEVO_HOST_DEVICE int64_t Eval(int64_t xc, int64_t yc) const { return (a * xc + b * yc) * xc + c * yc * yc; }
+
+    IMAGEEVO_HOST_DEVICE bool Contains(int xc, int yc) const {
+        return xc >= -bb && xc < bb && yc >= -bb && yc < bb && Eval(xc, yc) <= f;
+    }
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+// OpenCV is optional, without it the median backgrounds fall back to HistogramMedian
+#ifndef IMAGE_EVO_OPENCV
+#define IMAGE_EVO_OPENCV 0
+#endif
+
+#if IMAGE_EVO_OPENCV
+#include <opencv2/imgproc.hpp>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "engine.hpp"
+#include "geometry.hpp"
+#include "image.hpp"
+#include "trace.hpp"
+
+// Memory of the filters, kept by callers that filter frame after frame so they do not allocate every time
+struct BackgroundScratch {
+    std::vector<u32> integral;
+    // column histograms of the median, one set per channel
+    std::vector<u16> columns[3], coarse_columns[3];
+    Image result;
+};
+
+// Mean of every size x size window (size odd) of a BGR24 image into out of the same size, which may be image itself.
+// Windows get clipped at the border and average the pixels inside the image only. The integral image sums wrap around
+// in u32, the window sums themselves always fit.
+inline void BoxBlur(ConstImageView image, ImageView out, int size, BackgroundScratch& scratch) {
+    const int width = image.width, height = image.height, radius = size / 2;
+    const int stride = (width + 1) * 3;
+    std::vector<u32>& integral = scratch.integral;
+    // the top row and the left column are zero, everything else gets overwritten
+    integral.resize(u64(stride) * (height + 1));
+    std::fill(integral.begin(), integral.begin() + stride, 0);
+    for (int y = 0; y < height; ++y) {
+        const u8* row = image.Row(y);
+        const u32* above = &integral[u64(y) * stride];
+        u32* sums = &integral[u64(y + 1) * stride];
+        std::fill(sums, sums + 3, 0);
+        u32 acc[3] = {0, 0, 0};
+        for (int x = 0; x < width; ++x) {
+            for (int ch = 0; ch < 3; ++ch) {
+                acc[ch] += row[x * 3 + ch];
+                sums[(x + 1) * 3 + ch] = above[(x + 1) * 3 + ch] + acc[ch];
+            }
+        }
+    }
+
+    for (int y = 0; y < height; ++y) {
+        const int y0 = std::max(0, y - radius), y1 = std::min(height, y + radius + 1);
+        const u32* top = &integral[u64(y0) * stride];
+        const u32* bottom = &integral[u64(y1) * stride];
+        u8* row = out.Row(y);
+        for (int x = 0; x < width; ++x) {
+            const int x0 = std::max(0, x - radius), x1 = std::min(width, x + radius + 1);
+            const u32 count = (x1 - x0) * (y1 - y0);
+            for (int ch = 0; ch < 3; ++ch) {
+                const u32 sum = bottom[x1 * 3 + ch] - bottom[x0 * 3 + ch] - top[x1 * 3 + ch] + top[x0 * 3 + ch];
+                row[x * 3 + ch] = (sum + count / 2) / count;
+            }
+        }
+    }
+}
+
+// Constant time median filter after Perreault and Hebert: every column keeps a histogram of its size rows, the
+// window histogram slides along the row by adding one column histogram and removing another. The median is looked up
+// through 16 coarse bins first, and only the fine bins of the coarse bin holding the median get brought up to date.
+// Windows get clipped at the border like in BoxBlur.
+inline void HistogramMedianBlur(ConstImageView image, ImageView out, int size, BackgroundScratch& scratch) {
+    const int width = image.width, height = image.height, radius = size / 2;
+    Image& result = scratch.result;
+    result.Create(width, height);
+
+    // channels are independent, each one gets its own set of histograms
+    #pragma omp parallel for
+    for (int ch = 0; ch < 3; ++ch) {
+        std::vector<u16>& columns = scratch.columns[ch];
+        std::vector<u16>& coarse_columns = scratch.coarse_columns[ch];
+        columns.assign(u64(width) * 256, 0);
+        coarse_columns.assign(u64(width) * 16, 0);
+        auto add_row = [&](int y, int sign) {
+            const u8* row = image.Row(y);
+            for (int x = 0; x < width; ++x) {
+                columns[x * 256 + row[x * 3 + ch]] += sign;
+                coarse_columns[x * 16 + row[x * 3 + ch] / 16] += sign;
+            }
+        };
+        for (int y = 0; y < std::min(height, radius); ++y) add_row(y, 1);
+
+        for (int y = 0; y < height; ++y) {
+            if (y + radius < height) add_row(y + radius, 1);
+            if (y - radius - 1 >= 0) add_row(y - radius - 1, -1);
+            const u32 rows = std::min(height, y + radius + 1) - std::max(0, y - radius);
+
+            // the coarse window histogram follows every step, a fine segment only when the median lands in it
+            u32 coarse[16] = {};
+            u32 fine[256];
+            int synced[16];
+            std::fill(synced, synced + 16, -1);
+            auto add_columns = [&](int x0, int x1, int c, int sign) {
+                for (int x = std::max(0, x0); x < std::min(width, x1); ++x) {
+                    const u16* column = &columns[x * 256 + c * 16];
+                    for (int v = 0; v < 16; ++v) fine[c * 16 + v] += sign * column[v];
+                }
+            };
+            auto sync = [&](int c, int x) {
+                if (synced[c] < 0 || x - synced[c] > size) {
+                    std::fill(fine + c * 16, fine + c * 16 + 16, 0);
+                    add_columns(x - radius, x + radius + 1, c, 1);
+                } else {
+                    add_columns(synced[c] + radius + 1, x + radius + 1, c, 1);
+                    add_columns(synced[c] - radius, x - radius, c, -1);
+                }
+                synced[c] = x;
+            };
+            for (int x = 0; x < std::min(width, radius); ++x) {
+                for (int c = 0; c < 16; ++c) coarse[c] += coarse_columns[x * 16 + c];
+            }
+
+            u8* row = result.View().Row(y);
+            for (int x = 0; x < width; ++x) {
+                if (x + radius < width) {
+                    for (int c = 0; c < 16; ++c) coarse[c] += coarse_columns[(x + radius) * 16 + c];
+                }
+                if (x - radius - 1 >= 0) {
+                    for (int c = 0; c < 16; ++c) coarse[c] -= coarse_columns[(x - radius - 1) * 16 + c];
+                }
+                const u32 count = rows * (std::min(width, x + radius + 1) - std::max(0, x - radius));
+
+                // lower median of the window
+                const u32 target = (count + 1) / 2;
+                u32 seen = 0;
+                int c = 0;
+                while (seen + coarse[c] < target) seen += coarse[c++];
+                sync(c, x);
+                int v = c * 16;
+                while (seen + fine[v] < target) seen += fine[v++];
+                row[x * 3 + ch] = v;
+            }
+        }
+    }
+    CopyImage(result.View(), out);
+}
+
+#if IMAGE_EVO_OPENCV
+// header over the pixels of a view, no copy
+inline cv::Mat MatOf(ConstImageView view) {
+    return cv::Mat(view.height, view.width, CV_8UC3, const_cast<u8*>(view.data), view.stride);
+}
+#endif
+
+// Fills out, which has the size of image, with the background for image. size is the kernel size of the filters, odd.
+// Only the OpenCV medians allocate once scratch has grown to the image size.
+inline void InitBackground(Background background, ConstImageView image, ImageView out, BackgroundScratch& scratch,
+                           int size = 151) {
+    TRACE_SCOPE("background");
+    switch (background) {
+#if IMAGE_EVO_OPENCV
+    case Background::Median: {
+        cv::Mat result = MatOf(out);
+        cv::medianBlur(MatOf(image), result, size);
+        break;
+    }
+    case Background::DownsampleMedian: {
+        const int factor = std::max(1, std::min({8, image.width, image.height}));
+        cv::Mat small, result = MatOf(out);
+        cv::resize(MatOf(image), small, cv::Size(image.width / factor, image.height / factor), 0, 0, cv::INTER_AREA);
+        cv::medianBlur(small, small, std::max(3, (size / factor) | 1));
+        cv::resize(small, result, result.size(), 0, 0, cv::INTER_LINEAR);
+        break;
+    }
+#endif
+    case Background::Box:
+        BoxBlur(image, out, size, scratch);
+        break;
+    case Background::Gaussian: {
+        // a box of width w has a variance of (w^2 - 1) / 12
+        const double sigma = size / 6.0;
+        const int box = std::max(1, int(std::lround(std::sqrt(4 * sigma * sigma + 1))) | 1);
+        BoxBlur(image, out, box, scratch);
+        BoxBlur(out, out, box, scratch);
+        BoxBlur(out, out, box, scratch);
+        break;
+    }
+    case Background::Mean: {
+        u64 sums[3] = {0, 0, 0};
+        for (int y = 0; y < image.height; ++y) {
+            const u8* row = image.Row(y);
+            for (int x = 0; x < image.width; ++x) {
+                for (int ch = 0; ch < 3; ++ch) sums[ch] += row[x * 3 + ch];
+            }
+        }
+        const u64 count = std::max<u64>(1, u64(image.width) * image.height);
+        const u8 mean[3] = {u8((sums[0] + count / 2) / count), u8((sums[1] + count / 2) / count),
+                            u8((sums[2] + count / 2) / count)};
+        for (int y = 0; y < image.height; ++y) {
+            u8* row = out.Row(y);
+            for (int x = 0; x < image.width; ++x) {
+                for (int ch = 0; ch < 3; ++ch) row[x * 3 + ch] = mean[ch];
+            }
+        }
+        break;
+    }
+    // HistogramMedian, and without OpenCV the other medians too, which only differ at the border
+    default:
+        HistogramMedianBlur(image, out, size, scratch);
+        break;
+    }
+}
+
+inline void InitBackground(Background background, ConstImageView image, ImageView out, int size = 151) {
+    BackgroundScratch scratch;
+    InitBackground(background, image, out, scratch, size);
+}
+
+// Mean absolute error per channel and pixel between two BGR24 images of the same size
+inline double MeanAbsError(ConstImageView a, ConstImageView b) {
+    u64 sum = 0;
+    for (int y = 0; y < a.height; ++y) {
+        const u8* row_a = a.Row(y);
+        const u8* row_b = b.Row(y);
+        for (int x = 0; x < a.width * 3; ++x) sum += std::abs(row_a[x] - row_b[x]);
+    }
+    return double(sum) / std::max<u64>(1, u64(a.width) * a.height * 3);
+}
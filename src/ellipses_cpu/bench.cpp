@@ -0,0 +1,326 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "background.hpp"
+#include "convergence.hpp"
+#include "evolution.hpp"
+#include "geometry.hpp"
+#include "mat_view.hpp"
+#include "metrics.hpp"
+#include "perf.hpp"
+#include "raster.hpp"
+
+// Microbenchmarks of the hot paths on procedurally generated images, so every run measures the same work:
+// drawing, candidate fitness, background initialisation and whole generations. The check suite compares the fitness
+// kernels with each other.
+
+struct Resolution {
+    const char* name;
+    int width, height;
+};
+
+// largest axis of the ellipses as a fraction of the smaller image side
+struct SizeClass {
+    const char* name;
+    int divisor;
+};
+
+const Resolution resolutions[] = {{"256x256", 256, 256}, {"640x360", 640, 360}, {"1280x720", 1280, 720}};
+const SizeClass size_classes[] = {{"small", 32}, {"medium", 8}, {"large", 2}};
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Smooth gradients with hard edged shapes on top and a bit of noise, which gives the evolution both flat regions and
+// detail to work on
+cv::Mat SyntheticImage(int width, int height, u64 seed) {
+    cv::Mat image(height, width, CV_8UC3);
+    Rng rng(seed);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            u8* pixel = image.data + (x + y * width) * 3;
+            pixel[0] = 255 * x / width;
+            pixel[1] = 255 * y / height;
+            pixel[2] = 128 + 127 * std::sin((x + y) * 0.02);
+        }
+    }
+    for (int i = 0; i < 48; ++i) {
+        Ellipse e = RandomEllipse(width, height, rng);
+        e.major /= 2;
+        e.minor /= 2;
+        e.color = {u8(rng.Int(0, 255)), u8(rng.Int(0, 255)), u8(rng.Int(0, 255))};
+        DrawEllipse(ViewOf(image), EllipseRaster(width, height, e), e.color);
+    }
+    for (u64 i = 0; i < image.total() * 3; ++i) {
+        image.data[i] = std::clamp(image.data[i] + rng.Int(-8, 8), 0, 255);
+    }
+    return image;
+}
+
+std::vector<Ellipse> SyntheticEllipses(int width, int height, int divisor, u32 count, u64 seed) {
+    Rng rng(seed);
+    const int max_axis = std::max(1, std::min(width, height) / divisor);
+    std::vector<Ellipse> ellipses;
+    for (u32 i = 0; i < count; ++i) {
+        Ellipse e(Vec2u(rng.Int(0, width - 1), rng.Int(0, height - 1)), rng.Int(1, max_axis), rng.Int(1, max_axis),
+                  rng.Real(-5, 5));
+        e.color = {u8(rng.Int(0, 255)), u8(rng.Int(0, 255)), u8(rng.Int(0, 255))};
+        ellipses.push_back(e);
+    }
+    return ellipses;
+}
+
+u64 CoveredPixels(int width, int height, const std::vector<Ellipse>& ellipses) {
+    u64 pixels = 0;
+    for (const Ellipse& e : ellipses) {
+        const EllipseRaster raster(width, height, e);
+        for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+            int x0, x1;
+            if (raster.Span(y, x0, x1)) pixels += x1 - x0;
+        }
+    }
+    return pixels;
+}
+
+void PrintRate(const char* suite, const Resolution& res, const char* variant, double seconds, u64 pixels) {
+    printf("%-10s %-9s %-10s %8.3f ns/pixel %10.1f Mpixel/s\n", suite, res.name, variant, seconds * 1e9 / pixels,
+           pixels / seconds * 1e-6);
+}
+
+void BenchDraw(u64 seed) {
+    for (const Resolution& res : resolutions) {
+        cv::Mat canvas = SyntheticImage(res.width, res.height, seed);
+        for (const SizeClass& size : size_classes) {
+            const auto ellipses = SyntheticEllipses(res.width, res.height, size.divisor, 2000, seed + 1);
+            const u64 pixels = CoveredPixels(res.width, res.height, ellipses);
+            const auto start = std::chrono::steady_clock::now();
+            for (const Ellipse& e : ellipses) {
+                DrawEllipse(ViewOf(canvas), EllipseRaster(res.width, res.height, e), e.color);
+            }
+            PrintRate("draw", res, size.name, Seconds(start), pixels);
+        }
+    }
+}
+
+// EvaluateCandidate on a blurred canvas, once per fitness metric
+void BenchFitness(u64 seed) {
+    for (const Resolution& res : resolutions) {
+        const cv::Mat image = SyntheticImage(res.width, res.height, seed);
+        cv::Mat canvas(image.size(), CV_8UC3);
+        InitBackground(Background::Box, ViewOf(image), ViewOf(canvas));
+        for (Fitness fitness : {Fitness::L1, Fitness::L2}) {
+            EvoState state;
+            state.config.fitness = fitness;
+            InitState(state, ViewOf(canvas), ViewOf(image));
+            for (const SizeClass& size : size_classes) {
+                auto ellipses = SyntheticEllipses(res.width, res.height, size.divisor, 2000, seed + 1);
+                const u64 pixels = CoveredPixels(res.width, res.height, ellipses);
+                const auto start = std::chrono::steady_clock::now();
+                for (Ellipse& e : ellipses) EvaluateCandidate(state, e, false);
+                const std::string variant = std::string(fitness == Fitness::L2 ? "l2-" : "l1-") + size.name;
+                PrintRate("fitness", res, variant.c_str(), Seconds(start), pixels);
+            }
+        }
+    }
+}
+
+// Every background on image, best of a few runs with warm scratch buffers, so the once per run allocations of the
+// filters do not count
+void BenchBackgroundOn(const char* name, const cv::Mat& image) {
+    constexpr int runs = 5;
+    BackgroundScratch scratch;
+    cv::Mat background(image.size(), CV_8UC3);
+    for (int b = 0; b < background_count; ++b) {
+        double seconds = 0;
+        for (int run = 0; run < runs; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            InitBackground(Background(b), ViewOf(image), ViewOf(background), scratch);
+            seconds = run == 0 ? Seconds(start) : std::min(seconds, Seconds(start));
+        }
+        // the error the background leaves is what the evolution has to remove, a fast filter may not pay off
+        printf("%-10s %-9s %-10s %8.3f ns/pixel %10.1f Mpixel/s, mean error %6.2f\n", "background", name,
+               background_names[b], seconds * 1e9 / image.total(), image.total() / seconds * 1e-6,
+               MeanAbsError(ViewOf(image), ViewOf(background)));
+    }
+}
+
+// on the image at image_path if there is one, the synthetic images otherwise
+bool BenchBackground(u64 seed, const std::string& image_path) {
+    if (!image_path.empty()) {
+        const cv::Mat image = cv::imread(image_path);
+        if (image.empty()) {
+            printf("Failed to load %s\n", image_path.c_str());
+            return false;
+        }
+        const std::string name = std::to_string(image.cols) + "x" + std::to_string(image.rows);
+        BenchBackgroundOn(name.c_str(), image);
+        return true;
+    }
+    for (const Resolution& res : resolutions) BenchBackgroundOn(res.name, SyntheticImage(res.width, res.height, seed));
+    return true;
+}
+
+void BenchGeneration(u64 seed, u32 generations) {
+    for (const Resolution& res : resolutions) {
+        const cv::Mat image = SyntheticImage(res.width, res.height, seed);
+        for (Fitness fitness : {Fitness::L1, Fitness::L2}) {
+            cv::Mat canvas(image.size(), CV_8UC3);
+            InitBackground(Background::Box, ViewOf(image), ViewOf(canvas));
+            EvoState state;
+            state.config.fitness = fitness;
+            state.config.seed = seed;
+            InitState(state, ViewOf(canvas), ViewOf(image));
+            const auto start = std::chrono::steady_clock::now();
+            const EvolveResult result = Evolve(state, ViewOf(canvas), generations);
+            const double seconds = Seconds(start);
+            printf("%-10s %-9s %-10s %8.1f gen/s %12.0f mutations/s, mean error %.2f\n", "generation", res.name,
+                   fitness == Fitness::L2 ? "l2" : "l1", result.generations / seconds, result.mutations / seconds,
+                   MeanAbsError(ViewOf(image), ViewOf(canvas)));
+        }
+    }
+}
+
+// Every SpanDelta kernel the cpu supports against the scalar one, on random spans of every length up to a few vector
+// blocks at unaligned offsets. Returns false on the first mismatch.
+bool CheckSpanDelta(u64 seed) {
+    std::vector<std::pair<const char*, SpanDeltaFn>> kernels;
+#if IMAGEEVO_X86
+    kernels.push_back({"sse2", SpanDeltaSSE2});
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({"avx2", SpanDeltaAVX2});
+#endif
+    Rng rng(seed);
+    constexpr u32 max_pixels = 200;
+    std::vector<u8> original((max_pixels + 32) * 3), error((max_pixels + 32) * 3);
+    u64 spans = 0;
+    for (int round = 0; round < 16; ++round) {
+        for (u8& value : original) value = rng.Int(0, 255);
+        for (u8& value : error) value = rng.Int(0, 255);
+        for (u32 pixels = 0; pixels <= max_pixels; ++pixels) {
+            const u32 offset = rng.Int(0, 31) * 3;
+            const Color color = {u8(rng.Int(0, 255)), u8(rng.Int(0, 255)), u8(rng.Int(0, 255))};
+            const i64 expected = SpanDeltaScalar(&original[offset], &error[offset], pixels, color);
+            for (const auto& [name, kernel] : kernels) {
+                const i64 delta = kernel(&original[offset], &error[offset], pixels, color);
+                if (delta != expected) {
+                    printf("Kernel %s returned %lld instead of %lld for %u pixels at offset %u\n", name,
+                           (long long)delta, (long long)expected, pixels, offset);
+                    return false;
+                }
+            }
+            spans++;
+        }
+    }
+    printf("%-10s scalar", "check");
+    for (const auto& kernel : kernels) printf(", %s", kernel.first);
+    printf(" agree on %llu spans\n", (unsigned long long)spans);
+    return true;
+}
+
+// The corpus images and two synthetic ones, each run for every thread count of the sweep
+int BenchConvergence(const cv::CommandLineParser& parser, u64 seed) {
+    const std::string corpus_dir = parser.get<std::string>("corpus");
+    const double budget = parser.get<double>("budget"), interval = parser.get<double>("interval");
+    const std::string sweep = parser.get<std::string>("sweep");
+    const std::string fitness = parser.get<std::string>("f");
+    if (budget <= 0 || interval <= 0 || (fitness != "l1" && fitness != "l2")) {
+        printf("Invalid convergence budget, interval or fitness\n");
+        return 1;
+    }
+
+    std::vector<int> thread_counts;
+    for (u64 start = 0; start < sweep.size();) {
+        u64 end = sweep.find(',', start);
+        if (end == std::string::npos) end = sweep.size();
+        const int count = std::atoi(sweep.substr(start, end - start).c_str());
+        if (count < 1) {
+            printf("Invalid thread sweep %s\n", sweep.c_str());
+            return 1;
+        }
+        thread_counts.push_back(count);
+        start = end + 1;
+    }
+
+    std::vector<CorpusImage> corpus = LoadCorpus(corpus_dir, parser.get<int>("maxsize"));
+    for (u64 i = 0; i < 2; ++i) {
+        corpus.push_back({"synthetic-" + std::to_string(seed + i), SyntheticImage(640, 360, seed + i)});
+    }
+
+    EvoConfig config;
+    config.fitness = fitness == "l2" ? Fitness::L2 : Fitness::L1;
+    config.seed = seed;
+    std::vector<ConvergenceRun> runs;
+    for (const CorpusImage& image : corpus) {
+        for (int threads : thread_counts) {
+            runs.push_back(RunConvergence(image, config, threads, budget, interval));
+        }
+    }
+    PrintConvergenceSummary(runs);
+
+    const std::string csv = parser.get<std::string>("csv"), json = parser.get<std::string>("json");
+    if (!csv.empty() && !WriteConvergenceCsv(csv, runs)) {
+        printf("Failed to write %s\n", csv.c_str());
+        return 1;
+    }
+    if (!json.empty() && !WriteConvergenceJson(json, runs)) {
+        printf("Failed to write %s\n", json.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    cv::CommandLineParser parser(argc, argv,
+                                 "{suite s|all|check, draw, fitness, background, generation, all or convergence}"
+                                 "{threads t|1|number of threads}"
+                                 "{seed|1|seed of the synthetic images, ellipses and of the evolution}"
+                                 "{generations n|50|generations per run of the generation suite}"
+                                 "{image||background: time on this image file instead of the synthetic ones}"
+                                 "{perf||hardware counters of the fitness and draw kernels, runs them single threaded}"
+                                 "{corpus|examples|convergence: directory with the corpus images}"
+                                 "{maxsize|640|convergence: longer side the corpus images get downscaled to}"
+                                 "{budget|5|convergence: seconds of evolution per image and thread count}"
+                                 "{interval|0.25|convergence: seconds between error samples}"
+                                 "{sweep|1,4|convergence: comma separated thread counts}"
+                                 "{fitness f|l1|convergence: fitness metric, l1 or l2}"
+                                 "{csv|convergence.csv|convergence: curves as csv, empty to skip}"
+                                 "{json|convergence.json|convergence: curves and summary as json, empty to skip}");
+    const std::string suite = parser.get<std::string>("s");
+    const int threads = parser.get<int>("t");
+    const u64 seed = parser.get<u64>("seed");
+    const int generations = parser.get<int>("n");
+    if (suite != "all" && suite != "check" && suite != "draw" && suite != "fitness" && suite != "background" &&
+        suite != "generation" && suite != "convergence") {
+        printf("Invalid suite %s\n", suite.c_str());
+        return 1;
+    }
+    if (threads < 1 || generations < 1) {
+        printf("Invalid thread or generation count\n");
+        return 1;
+    }
+    omp_set_num_threads(threads);
+    if (parser.has("perf")) Perf().Enable();
+    printf("ImageEvo bench on %d thread(s), %s fitness kernel, seed %llu\n", omp_get_max_threads(),
+           SpanDeltaName(SelectSpanDelta()), (unsigned long long)seed);
+
+    // end to end and much longer than the others, only on request
+    if (suite == "convergence") return BenchConvergence(parser, seed);
+    // the timings are worthless if the kernels disagree
+    if ((suite == "all" || suite == "check") && !CheckSpanDelta(seed)) return 1;
+    if (suite == "all" || suite == "draw") BenchDraw(seed);
+    if (suite == "all" || suite == "fitness") BenchFitness(seed);
+    if ((suite == "all" || suite == "background") && !BenchBackground(seed, parser.get<std::string>("image"))) return 1;
+    if (suite == "all" || suite == "generation") BenchGeneration(seed, generations);
+    if (Perf().Enabled()) Perf().Print(Metrics().generations.Value());
+    return 0;
+}
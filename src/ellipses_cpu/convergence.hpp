@@ -0,0 +1,190 @@
+#pragma once
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "background.hpp"
+#include "evolution.hpp"
+#include "mat_view.hpp"
+
+// End to end convergence runs: the whole engine on a fixed corpus, with the error sampled over the time spent in the
+// evolution. Quality per cpu second is what decides whether a change pays off, generations per second alone do not.
+
+struct CorpusImage {
+    std::string name;
+    cv::Mat image;
+};
+
+struct ErrorSample {
+    double seconds = 0;
+    u32 generations = 0;
+    u64 mutations = 0;
+    // mean absolute and mean squared error per channel and pixel
+    double l1 = 0, mse = 0, psnr = 0;
+};
+
+struct ConvergenceRun {
+    std::string image;
+    int width = 0, height = 0, threads = 0;
+    std::vector<ErrorSample> samples;
+};
+
+// PSNR levels the summary reports the time to reach for
+const double psnr_levels[] = {20, 25, 30};
+
+// The images of directory, downscaled to at most max_size pixels on the longer side
+inline std::vector<CorpusImage> LoadCorpus(const std::string& directory, int max_size) {
+    std::vector<std::string> paths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        const std::string extension = entry.path().extension().string();
+        if (extension == ".png" || extension == ".jpg" || extension == ".bmp") paths.push_back(entry.path().string());
+    }
+    // directory order is unspecified
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<CorpusImage> corpus;
+    for (const std::string& path : paths) {
+        cv::Mat image = cv::imread(path);
+        if (!image.data || image.channels() != 3) {
+            printf("Skipping %s\n", path.c_str());
+            continue;
+        }
+        const double scale = double(max_size) / std::max(image.cols, image.rows);
+        if (scale < 1) cv::resize(image, image, cv::Size(image.cols * scale, image.rows * scale), 0, 0, cv::INTER_AREA);
+        corpus.push_back({std::filesystem::path(path).filename().string(), image});
+    }
+    return corpus;
+}
+
+inline ErrorSample MeasureError(const EvoState& state) {
+    u64 abs_sum = 0, square_sum = 0;
+    #pragma omp parallel for reduction(+:abs_sum, square_sum)
+    for (u64 i = 0; i < state.error.size(); ++i) {
+        abs_sum += state.error[i];
+        square_sum += u32(state.error[i]) * state.error[i];
+    }
+    ErrorSample sample;
+    const double count = std::max<u64>(1, state.error.size());
+    sample.l1 = abs_sum / count;
+    sample.mse = square_sum / count;
+    sample.psnr = sample.mse > 0 ? 10 * std::log10(255.0 * 255.0 / sample.mse) : 99.0;
+    return sample;
+}
+
+// Evolves image for budget seconds of evolution time and samples the error every interval seconds. Samples are taken
+// between generations and their cost is not counted, so the curve only reflects the evolution itself.
+inline ConvergenceRun RunConvergence(const CorpusImage& corpus_image, const EvoConfig& config, int threads,
+                                     double budget, double interval) {
+    omp_set_num_threads(threads);
+    const cv::Mat& image = corpus_image.image;
+    cv::Mat canvas(image.size(), CV_8UC3);
+    InitBackground(config.background, ViewOf(image), ViewOf(canvas));
+    EvoState state;
+    state.config = config;
+    InitState(state, ViewOf(canvas), ViewOf(image));
+
+    ConvergenceRun run{corpus_image.name, image.cols, image.rows, threads, {}};
+    run.samples.push_back(MeasureError(state));
+    double elapsed = 0, next_sample = interval;
+    u32 generations = 0;
+    u64 mutations = 0;
+    while (elapsed < budget) {
+        const auto start = std::chrono::steady_clock::now();
+        const EvolveResult result = Evolve(state, ViewOf(canvas), 1);
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        generations += result.generations;
+        mutations += result.mutations;
+        if (elapsed >= next_sample || elapsed >= budget) {
+            ErrorSample sample = MeasureError(state);
+            sample.seconds = elapsed;
+            sample.generations = generations;
+            sample.mutations = mutations;
+            run.samples.push_back(sample);
+            next_sample = (std::floor(elapsed / interval) + 1) * interval;
+        }
+    }
+    return run;
+}
+
+// seconds until the run first reached psnr, negative if it never did
+inline double TimeToPsnr(const ConvergenceRun& run, double psnr) {
+    for (const ErrorSample& sample : run.samples) {
+        if (sample.psnr >= psnr) return sample.seconds;
+    }
+    return -1;
+}
+
+inline bool WriteConvergenceCsv(const std::string& path, const std::vector<ConvergenceRun>& runs) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "image,width,height,threads,seconds,generations,mutations,l1,mse,psnr\n");
+    for (const ConvergenceRun& run : runs) {
+        for (const ErrorSample& s : run.samples) {
+            fprintf(file, "%s,%d,%d,%d,%.4f,%u,%llu,%.4f,%.4f,%.4f\n", run.image.c_str(), run.width, run.height,
+                    run.threads, s.seconds, s.generations, (unsigned long long)s.mutations, s.l1, s.mse, s.psnr);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+inline bool WriteConvergenceJson(const std::string& path, const std::vector<ConvergenceRun>& runs) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "{\"runs\": [");
+    for (u64 r = 0; r < runs.size(); ++r) {
+        const ConvergenceRun& run = runs[r];
+        fprintf(file, "%s\n  {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d,", r ? "," : "",
+                run.image.c_str(), run.width, run.height, run.threads);
+        fprintf(file, "\n   \"time_to_psnr\": {");
+        for (u64 l = 0; l < std::size(psnr_levels); ++l) {
+            const double seconds = TimeToPsnr(run, psnr_levels[l]);
+            fprintf(file, "%s\"%g\": ", l ? ", " : "", psnr_levels[l]);
+            if (seconds < 0) {
+                fprintf(file, "null");
+            } else {
+                fprintf(file, "%.4f", seconds);
+            }
+        }
+        fprintf(file, "},\n   \"samples\": [");
+        for (u64 i = 0; i < run.samples.size(); ++i) {
+            const ErrorSample& s = run.samples[i];
+            fprintf(file,
+                    "%s\n    {\"seconds\": %.4f, \"generations\": %u, \"mutations\": %llu, "
+                    "\"l1\": %.4f, \"mse\": %.4f, \"psnr\": %.4f}",
+                    i ? "," : "", s.seconds, s.generations, (unsigned long long)s.mutations, s.l1, s.mse, s.psnr);
+        }
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+inline void PrintConvergenceSummary(const std::vector<ConvergenceRun>& runs) {
+    printf("%-28s %-10s %7s %9s %8s", "image", "size", "threads", "final l1", "psnr");
+    for (double level : psnr_levels) printf("  to %2.0f dB", level);
+    printf("\n");
+    for (const ConvergenceRun& run : runs) {
+        const ErrorSample& last = run.samples.back();
+        const std::string size = std::to_string(run.width) + "x" + std::to_string(run.height);
+        printf("%-28s %-10s %7d %9.2f %8.2f", run.image.c_str(), size.c_str(), run.threads, last.l1, last.psnr);
+        for (double level : psnr_levels) {
+            const double seconds = TimeToPsnr(run, level);
+            if (seconds < 0) {
+                printf("  %8s", "-");
+            } else {
+                printf("  %7.2fs", seconds);
+            }
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,95 @@
+#include "engine.hpp"
+
+#include <cstdio>
+
+#include "background.hpp"
+#include "evolution.hpp"
+
+struct Engine::State {
+    EvoState evo;
+    ImageView canvas;
+    std::vector<i64> last_tile_error;
+};
+
+const char* ConfigError(const EvoConfig& config) {
+    if (config.fitness != Fitness::L1 && config.fitness != Fitness::L2) return "unknown fitness";
+    if (config.parallelism != Parallelism::Auto && config.parallelism != Parallelism::Pixels &&
+        config.parallelism != Parallelism::Candidates) {
+        return "unknown parallelism";
+    }
+    if (int(config.background) < 0 || int(config.background) >= background_count) return "unknown background";
+    if (config.batch_size < 1 || config.batch_area < 0) return "empty candidate batches";
+    if (config.screen_level < 0 || config.screen_level > 4) return "screening level outside of 0 to 4";
+    if (config.mutations < 1 || config.restart_limit < 1) return "no candidates per generation";
+    if (!(config.warm_threshold >= 0)) return "negative warm start threshold";
+    return nullptr;
+}
+
+Engine::Engine(const EvoConfig& config) : state(std::make_unique<State>()) {
+    state->evo.config = config;
+    const char* error = ConfigError(config);
+    if (error) printf("Invalid engine config: %s\n", error);
+    valid = !error;
+}
+
+Engine::~Engine() = default;
+Engine::Engine(Engine&&) noexcept = default;
+Engine& Engine::operator=(Engine&&) noexcept = default;
+
+const EvoConfig& Engine::Config() const { return state->evo.config; }
+
+void Engine::Reseed(u64 seed) {
+    state->evo.config.seed = seed;
+    state->evo.candidate_counter = 0;
+}
+
+void Engine::Reset(ConstImageView target, ImageView canvas) {
+    if (!valid) return;
+    state->canvas = canvas;
+    state->evo.shapes.clear();
+    InitState(state->evo, canvas, target);
+}
+
+void Engine::Step() {
+    if (valid && !state->canvas.Empty()) NextGeneration(state->evo, state->canvas);
+}
+
+EvolveResult Engine::Run(u32 gen_limit, double budget_ms) {
+    if (!valid || state->canvas.Empty()) return {};
+    return Evolve(state->evo, state->canvas, gen_limit, BudgetDeadline(budget_ms));
+}
+
+EvolveResult Engine::EvolveFrame(ConstImageView frame, ImageView out, u32 gen_limit, double budget_ms) {
+    if (!valid) return {};
+    state->canvas = out;
+    return ::EvolveFrame(state->evo, frame, out, gen_limit, budget_ms, state->last_tile_error);
+}
+
+const std::vector<Ellipse>& Engine::Shapes() const { return state->evo.shapes; }
+
+BoundingBox Engine::TakeDirty() {
+    const BoundingBox dirty = state->evo.dirty;
+    state->evo.dirty = {0, 0, 0, 0};
+    return dirty;
+}
+
+void Engine::MergeStats(const Engine& other) {
+    ScreenStats& stats = state->evo.screen_stats;
+    const ScreenStats& from = other.state->evo.screen_stats;
+    stats.screened += from.screened;
+    stats.rejected += from.rejected;
+    stats.full_pixels += from.full_pixels;
+    stats.rejected_pixels += from.rejected_pixels;
+    stats.coarse_ns += from.coarse_ns;
+    stats.full_ns += from.full_ns;
+}
+
+void Engine::PrintStats() const { PrintScreenStats(state->evo); }
+
+void FillBackground(Background background, ConstImageView image, ImageView out) {
+    InitBackground(background, image, out);
+}
+
+double ImageError(ConstImageView a, ConstImageView b) { return MeanAbsError(a, b); }
+
+const char* FitnessKernelName() { return SpanDeltaName(SelectSpanDelta()); }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "image.hpp"
+
+enum class Fitness { L1, L2 };
+// Pixels evaluates one candidate at a time with all threads, Candidates evaluates a batch of candidates with one
+// candidate per thread, Auto picks by the footprint of the candidate
+enum class Parallelism { Auto, Pixels, Candidates };
+
+// Initial canvas the shapes get evolved on top of
+enum class Background {
+    // cv::medianBlur, the cost grows with the kernel size
+    Median,
+    // mean of the window from an integral image
+    Box,
+    // three box passes, which approximate a gaussian with sigma = size / 6
+    Gaussian,
+    // median on 1/8 resolution, upscaled bilinearly
+    DownsampleMedian,
+    // mean color of the whole image
+    Mean,
+    // median from running histograms, constant time per pixel regardless of the kernel size
+    HistogramMedian
+};
+
+// command line names, in the order of Background
+const char* const background_names[] = {"median", "box", "gaussian", "downmedian", "mean", "histmedian"};
+constexpr int background_count = sizeof(background_names) / sizeof(background_names[0]);
+
+// Settings of the evolution, shared by all engines of a run
+struct EvoConfig {
+    // L2 scores shapes from the prefix sums and fills them with their mean color
+    Fitness fitness = Fitness::L1;
+    Parallelism parallelism = Parallelism::Auto;
+    // candidates per batch, independent of the thread count so the search does not depend on it
+    u32 batch_size = 32;
+    // bounding box area up to which Auto evaluates candidates in batches
+    int batch_area = 256 * 256;
+    // every candidate draws from its own stream keyed by the candidate counter, see Rng
+    u64 seed = 0;
+    // L1 candidates are screened on the pyramid level 1 / 2^screen_level first, 0 disables the screening
+    int screen_level = 0;
+    double screen_margin = 0.0;
+    // new ellipses are placed proportionally to the error of the canvas instead of uniformly
+    bool error_sampling = true;
+    // candidates a generation evaluates once it found an improvement
+    int mutations = 500;
+    // random candidates evaluated without any improvement before a generation gives up
+    u32 restart_limit = 16384;
+    Background background = Background::Median;
+    // video only: re-evolve tiles whose error rose by more than this per channel and pixel, 0 disables the warm start.
+    // It picks the tiles through the error sampler, without error sampling every frame starts from scratch.
+    double warm_threshold = 0.0;
+};
+
+struct EvolveResult {
+    u32 generations = 0;
+    // candidates evaluated, including random restarts and a generation cut short
+    u64 mutations = 0;
+    // the deadline ended the evolution before the generation limit
+    bool expired = false;
+};
+
+// defined in raster.hpp and geometry.hpp, which callers include to use the dirty region and the shapes
+struct BoundingBox;
+struct Ellipse;
+
+// Describes what is wrong with config, null if an engine can run with it
+const char* ConfigError(const EvoConfig& config);
+
+// Public interface of the libimageevo engine, which the command line, the SDL preview and embedders build on. It
+// depends on the standard library only, the internals in evolution.hpp stay behind it. Images are views of memory
+// the caller owns and keeps alive while the engine uses them.
+class Engine {
+public:
+    // An invalid config, see ConfigError, gets reported and leaves the engine invalid, which then does nothing
+    explicit Engine(const EvoConfig& config = EvoConfig());
+    ~Engine();
+    Engine(Engine&&) noexcept;
+    Engine& operator=(Engine&&) noexcept;
+
+    bool IsValid() const { return valid; }
+    const EvoConfig& Config() const;
+    // restarts the candidate streams from the first candidate of seed
+    void Reseed(u64 seed);
+
+    // Evolves canvas towards target from here on, starting with what canvas shows, see FillBackground. Both have the
+    // same size and must stay valid until the next Reset. Clears the shape list.
+    void Reset(ConstImageView target, ImageView canvas);
+    // one generation on the canvas of the last Reset
+    void Step();
+    // up to gen_limit generations within budget_ms, 0 for no time limit
+    EvolveResult Run(u32 gen_limit, double budget_ms = 0);
+
+    // Evolves out, of the size of frame, towards frame as the next frame of a video: out gets the background of frame
+    // and, with a warm start, the shapes of the previous frame first. budget_ms limits the whole frame.
+    EvolveResult EvolveFrame(ConstImageView frame, ImageView out, u32 gen_limit, double budget_ms = 0);
+
+    // every accepted shape in drawing order
+    const std::vector<Ellipse>& Shapes() const;
+    // region of the canvas changed since the last call
+    BoundingBox TakeDirty();
+
+    // adds the screening statistics of other to the ones of this engine
+    void MergeStats(const Engine& other);
+    void PrintStats() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+    bool valid = false;
+};
+
+// Fills out, of the size of image, with the background for image
+void FillBackground(Background background, ConstImageView image, ImageView out);
+
+// Mean absolute error per channel and pixel between two images of the same size
+double ImageError(ConstImageView a, ConstImageView b);
+
+// Name of the fitness kernel the engine picked for this cpu
+const char* FitnessKernelName();
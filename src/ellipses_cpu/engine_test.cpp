@@ -0,0 +1,97 @@
+#include <cmath>
+#include <cstdio>
+
+#include "engine.hpp"
+#include "geometry.hpp"
+#include "imageevo.h"
+
+// Checks of the engine through its public and its C interface, run by ctest. They need neither OpenCV nor SDL.
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what) {
+    if (condition) return;
+    printf("FAILED: %s\n", what);
+    ++failures;
+}
+
+// diagonal gradient with a dark square at (x, y)
+static void FillFrame(ImageView frame, int x, int y, int size) {
+    for (int row = 0; row < frame.height; ++row) {
+        u8* pixel = frame.Row(row);
+        for (int col = 0; col < frame.width; ++col, pixel += 3) {
+            const bool square = col >= x && col < x + size && row >= y && row < y + size;
+            pixel[0] = square ? 20 : u8(col * 255 / frame.width);
+            pixel[1] = square ? 40 : u8(row * 255 / frame.height);
+            pixel[2] = square ? 60 : u8((col + row) * 127 / (frame.width + frame.height));
+        }
+    }
+}
+
+// The command line passes its warm start threshold along with uniform sampling, the engine has to take that and start
+// every frame from scratch instead
+static void WarmStartWithoutSampling() {
+    EvoConfig config;
+    config.seed = 1;
+    config.error_sampling = false;
+    config.warm_threshold = 4;
+    Engine engine(config);
+    Check(engine.IsValid(), "warm start without error sampling is a valid config");
+
+    Image frame(96, 64), out(96, 64);
+    FillFrame(frame.View(), 16, 16, 24);
+    for (int i = 0; i < 3; ++i) {
+        const EvolveResult result = engine.EvolveFrame(frame.View(), out.View(), 8);
+        // a warm start would find nothing to do on the repeated frame
+        Check(result.generations > 0, "every frame without error sampling starts from scratch");
+    }
+}
+
+// A static clip whose shapes outgrow the cap of 2 * gen_limit: dropping the oldest shapes is no change of the video,
+// so neither a scene cut nor re-evolved tiles may follow from it
+static void WarmStartEviction() {
+    EvoConfig config;
+    config.seed = 1;
+    config.warm_threshold = 4;
+    Engine engine(config);
+
+    Image frame(96, 64), out(96, 64);
+    FillFrame(frame.View(), 16, 16, 24);
+    engine.EvolveFrame(frame.View(), out.View(), 32);
+    constexpr u32 gen_limit = 4;
+    Check(engine.Shapes().size() > 2 * gen_limit, "the first frame leaves more shapes than the cap");
+    for (int i = 0; i < 4; ++i) {
+        const EvolveResult result = engine.EvolveFrame(frame.View(), out.View(), gen_limit);
+        Check(result.generations == 0, "a static frame evolves no tiles after the eviction");
+        Check(engine.Shapes().size() == 2 * gen_limit, "the shapes are capped instead of restarted by a scene cut");
+    }
+}
+
+// Budgets that are not a time in milliseconds get rejected before anything runs
+static void CInterfaceBudget() {
+    ImageEvoConfig config;
+    imageevo_default_config(&config);
+    Check(config.background == IMAGEEVO_BACKGROUND_HISTOGRAM_MEDIAN, "the default background is the histogram median");
+    ImageEvoEngine* engine = imageevo_create(&config);
+    Check(engine, "the default config creates an engine");
+    if (!engine) return;
+
+    Image frame(64, 48);
+    FillFrame(frame.View(), 8, 8, 16);
+    const ImageEvoImage image = {frame.View().data, frame.width, frame.height, frame.View().stride, IMAGEEVO_BGR24};
+    for (double budget : {-1.0, double(NAN), double(INFINITY)}) {
+        Check(imageevo_evolve_frame(engine, &image, &image, 4, budget, nullptr) == IMAGEEVO_INVALID_ARGUMENT,
+              "negative and non finite budgets are invalid");
+    }
+    Check(imageevo_evolve_frame(engine, &image, &image, 4, 0, nullptr) == IMAGEEVO_OK, "no budget evolves in place");
+    imageevo_destroy(engine);
+}
+
+int main() {
+    WarmStartWithoutSampling();
+    WarmStartEviction();
+    CInterfaceBudget();
+    if (failures) return 1;
+    printf("All engine checks passed\n");
+    return 0;
+}
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <omp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "background.hpp"
+#include "engine.hpp"
+#include "geometry.hpp"
+#include "image.hpp"
+#include "metrics.hpp"
+#include "perf.hpp"
+#include "prefix_sums.hpp"
+#include "pyramid.hpp"
+#include "raster.hpp"
+#include "sad.hpp"
+#include "sampler.hpp"
+#include "trace.hpp"
+
+// Coarse screening counters, updated concurrently by the batch workers. The pixel counts are in full resolution
+// pixels, rejected_pixels estimates how many were not evaluated thanks to the screening.
+struct ScreenStats {
+    std::atomic<u64> screened{0}, rejected{0};
+    std::atomic<u64> full_pixels{0}, rejected_pixels{0};
+    std::atomic<u64> coarse_ns{0}, full_ns{0};
+};
+
+// Persistent state of the evolution. The error map mirrors |original - canvas| per channel, which allows
+// candidates to be scored by their difference to the current canvas inside their own footprint only.
+struct EvoState {
+    EvoConfig config;
+    int width = 0, height = 0;
+    ConstImageView original;
+    // tightly packed, unlike the original and the canvas
+    std::vector<u8> error;
+    SpanDeltaFn span_delta = SelectSpanDelta();
+    RowPrefixSums sums;
+    // pixels of the canvas underneath the bounding box of the current best fit
+    std::vector<u8> backup;
+    u64 candidate_counter = 0;
+    Pyramid original_pyramid, canvas_pyramid;
+    std::vector<u8> coarse_error;
+    ScreenStats screen_stats;
+    ErrorSampler sampler;
+    // every accepted best fit in the order it got drawn
+    std::vector<Ellipse> shapes;
+    // canvas region changed since the owner last reset it
+    BoundingBox dirty = {0, 0, 0, 0};
+    // video only: the background of the frame, in case the warm start has to start over
+    Image background;
+    // memory reused from one generation or frame to the next, so a running engine does not allocate
+    BackgroundScratch background_scratch;
+    std::vector<Ellipse> batch;
+    std::vector<i64> batch_deltas;
+    std::vector<u8> changed_tiles;
+    std::vector<i64> frame_tile_error;
+};
+
+inline u64 ElapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline bool UseScreening(const EvoState& state) {
+    return state.config.screen_level > 0 && state.config.fitness == Fitness::L1;
+}
+
+// rebuilds the coarse canvas and its error inside of the given full resolution region
+inline void UpdateCoarse(EvoState& state, ConstImageView canvas, const BoundingBox& box) {
+    state.canvas_pyramid.Update(canvas, box);
+    const PyramidLevel& original = state.original_pyramid.Top();
+    const PyramidLevel& coarse = state.canvas_pyramid.Top();
+    const int scale = 1 << state.config.screen_level;
+    const int end_x = std::min(coarse.width, (box.end_x + scale - 1) / scale);
+    for (int y = box.start_y / scale; y < std::min(coarse.height, (box.end_y + scale - 1) / scale); ++y) {
+        for (u32 index = (box.start_x / scale + y * coarse.width) * 3; index < u32(end_x + y * coarse.width) * 3;
+             ++index) {
+            state.coarse_error[index] = std::abs(int(original.data[index]) - int(coarse.data[index]));
+        }
+    }
+}
+
+inline void SaveRegion(ConstImageView canvas, const BoundingBox& box, std::vector<u8>& backup) {
+    const u32 row_size = (box.end_x - box.start_x) * 3;
+    backup.resize(row_size * std::max(0, box.end_y - box.start_y));
+    for (int y = box.start_y; y < box.end_y; ++y) {
+        std::memcpy(backup.data() + (y - box.start_y) * row_size, canvas.Row(y) + box.start_x * 3, row_size);
+    }
+    Metrics().bytes_copied.Add(backup.size());
+}
+
+inline void RestoreRegion(ImageView canvas, const BoundingBox& box, const std::vector<u8>& backup) {
+    const u32 row_size = (box.end_x - box.start_x) * 3;
+    for (int y = box.start_y; y < box.end_y; ++y) {
+        std::memcpy(canvas.Row(y) + box.start_x * 3, backup.data() + (y - box.start_y) * row_size, row_size);
+    }
+    Metrics().bytes_copied.Add(u64(row_size) * std::max(0, box.end_y - box.start_y));
+}
+
+inline void UpdateError(EvoState& state, ConstImageView canvas, const EllipseRaster& raster) {
+    #pragma omp parallel for
+    for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+        int x0, x1;
+        if (!raster.Span(y, x0, x1)) continue;
+        const u8* original = state.original.Row(y);
+        const u8* row = canvas.Row(y);
+        u8* error = state.error.data() + u64(y) * state.width * 3;
+        for (int i = x0 * 3; i < x1 * 3; ++i) error[i] = std::abs(int(original[i]) - int(row[i]));
+        if (state.config.fitness == Fitness::L2) state.sums.UpdateErrorRow(y, state.error.data());
+    }
+    if (UseScreening(state)) UpdateCoarse(state, canvas, raster.box);
+    if (state.config.error_sampling) state.sampler.Update(state.error.data(), raster.box);
+}
+
+// Must be called whenever the canvas or the original image got replaced, both have the same size and must outlive
+// the use of the state
+inline void InitState(EvoState& state, ConstImageView canvas, ConstImageView original) {
+    const int width = original.width, height = original.height;
+    state.width = width;
+    state.height = height;
+    state.original = original;
+    state.error.resize(u64(width) * height * 3);
+    #pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        const u8* original_row = original.Row(y);
+        const u8* row = canvas.Row(y);
+        u8* error = state.error.data() + u64(y) * width * 3;
+        for (int i = 0; i < width * 3; ++i) error[i] = std::abs(int(original_row[i]) - int(row[i]));
+    }
+    if (state.config.fitness == Fitness::L2) state.sums.Init(original, state.error.data());
+    if (UseScreening(state)) {
+        state.original_pyramid.Init(original, state.config.screen_level);
+        state.canvas_pyramid.Init(canvas, state.config.screen_level);
+        state.coarse_error.resize(state.original_pyramid.Top().data.size());
+        UpdateCoarse(state, canvas, {0, width, 0, height});
+    }
+    if (state.config.error_sampling) state.sampler.Init(width, height, state.error.data());
+}
+
+inline void DrawEllipse(ImageView canvas, const EllipseRaster& raster, const Color& color) {
+    PerfScope perf(Perf().draw);
+    u64 pixels = 0;
+    #pragma omp parallel for reduction(+:pixels) if(!Perf().Enabled())
+    for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+        int x0, x1;
+        if (!raster.Span(y, x0, x1)) continue;
+        u8* row = canvas.Row(y);
+        for (int index = x0 * 3; index < x1 * 3; index += 3) {
+            row[index] = color.r;
+            row[index + 1] = color.g;
+            row[index + 2] = color.b;
+        }
+        pixels += x1 - x0;
+    }
+    Metrics().pixels_drawn.Add(pixels);
+    perf.pixels = pixels;
+}
+
+inline Ellipse RandomCandidate(const EvoState& state, Rng& rng) {
+    Ellipse e = RandomEllipse(state.width, state.height, rng);
+    if (state.config.error_sampling) state.sampler.Sample(rng, e.origin);
+    const u8* pixel = state.original.Row(e.origin.y) + e.origin.x * 3;
+    e.color = {pixel[0], pixel[1], pixel[2]};
+    return e;
+}
+
+// Scores e on the top level of the pyramid. Only candidates that gain at least screen_margin per channel and pixel
+// there are worth a verification at full resolution. Candidates that are too small for the coarse level always pass.
+inline bool ScreenCandidate(EvoState& state, const Ellipse& e) {
+    const auto start = std::chrono::steady_clock::now();
+    const PyramidLevel& original = state.original_pyramid.Top();
+    const int scale = 1 << state.config.screen_level;
+    Ellipse coarse = e;
+    coarse.origin = Vec2u(e.origin.x / scale, e.origin.y / scale);
+    coarse.major = (e.major + scale / 2) / scale;
+    coarse.minor = (e.minor + scale / 2) / scale;
+
+    const EllipseRaster raster(original.width, original.height, coarse);
+    i64 delta = 0, pixels = 0;
+    for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+        int x0, x1;
+        if (!raster.Span(y, x0, x1)) continue;
+        const u32 index = (x0 + y * original.width) * 3;
+        delta += state.span_delta(original.data.data() + index, state.coarse_error.data() + index, x1 - x0, e.color);
+        pixels += x1 - x0;
+    }
+    if (pixels < 16) return true;
+
+    ScreenStats& stats = state.screen_stats;
+    stats.screened++;
+    stats.coarse_ns += ElapsedNs(start);
+    if (delta < -state.config.screen_margin * pixels * 3) return true;
+    stats.rejected++;
+    stats.rejected_pixels += pixels * scale * scale;
+    return false;
+}
+
+inline void PrintScreenStats(const EvoState& state) {
+    if (!UseScreening(state)) return;
+    const ScreenStats& stats = state.screen_stats;
+    // the cost of the rejected candidates is estimated from the measured cost per full resolution pixel
+    const double ns_per_pixel = stats.full_pixels ? double(stats.full_ns) / stats.full_pixels : 0.0;
+    const double saved_ms = (stats.rejected_pixels * ns_per_pixel - stats.coarse_ns) * 1e-6;
+    printf("Screening rejected %llu of %llu candidates (%.1f%%), saved ~%.1f ms of cpu time\n",
+           (unsigned long long)stats.rejected.load(), (unsigned long long)stats.screened.load(),
+           stats.screened ? 100.0 * stats.rejected / stats.screened : 0.0, saved_ms);
+}
+
+// Change of the error if e got painted onto the canvas. Pixels outside of the ellipse keep their error, so only the
+// change inside of it decides the fitness. In L2 mode the color of e is set to the optimal fill.
+inline i64 EvaluateCandidate(EvoState& state, Ellipse& e, bool parallel) {
+    const EllipseRaster raster(state.width, state.height, e);
+    if (state.config.fitness == Fitness::L2) {
+        PerfScope perf(Perf().fitness);
+        const ShapeSums sums(state.sums, raster);
+        e.color = sums.MeanColor();
+        Metrics().pixels_evaluated.Add(sums.pixels);
+        perf.pixels = sums.pixels;
+        return sums.Delta(e.color);
+    }
+
+    const bool screening = UseScreening(state);
+    // a rejected candidate counts as no improvement
+    if (screening && !ScreenCandidate(state, e)) return 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    PerfScope perf(Perf().fitness);
+    const u8* error = state.error.data();
+    i64 delta = 0, pixels = 0;
+    #pragma omp parallel for reduction(+:delta, pixels) if(parallel && !Perf().Enabled())
+    for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+        int x0, x1;
+        if (!raster.Span(y, x0, x1)) continue;
+        delta += state.span_delta(state.original.Row(y) + x0 * 3, error + (x0 + u64(y) * state.width) * 3, x1 - x0,
+                                  e.color);
+        pixels += x1 - x0;
+    }
+    Metrics().pixels_evaluated.Add(pixels);
+    perf.pixels = pixels;
+    if (screening) {
+        state.screen_stats.full_pixels += pixels;
+        state.screen_stats.full_ns += ElapsedNs(start);
+    }
+    return delta;
+}
+
+inline bool UseCandidateBatch(const EvoState& state, const Ellipse& e) {
+    if (state.config.parallelism != Parallelism::Auto) return state.config.parallelism == Parallelism::Candidates;
+    // L2 scores in O(rows), which never amortizes a parallel region
+    if (state.config.fitness == Fitness::L2) return true;
+    const BoundingBox box = GetBoundingBox(state.width, state.height, e);
+    return (box.end_x - box.start_x) * (box.end_y - box.start_y) < state.config.batch_area;
+}
+
+// Mutates the best fit of this generation directly on the canvas. Only the bounding box of the best fit gets backed
+// up, replacing it with a better candidate restores that region instead of copying the whole frame.
+// Small candidates are evaluated in batches of independent mutations of the best fit, one per worker, as the fork/join
+// overhead of a parallel region per candidate would dominate the few pixels they cover.
+// Returns false if the deadline cut the generation short, the best fit found until then is kept
+inline bool NextGeneration(EvoState& state, ImageView canvas,
+                           std::chrono::steady_clock::time_point deadline =
+                               std::chrono::steady_clock::time_point::max()) {
+    TRACE_SCOPE("generation");
+    EngineMetrics& metrics = Metrics();
+    const ScopedLatency latency(metrics.generation_latency);
+    const int width = state.width, height = state.height;
+    int current_mutation = 0;
+    bool first_hit = false;
+
+    Ellipse best_fit(Vec2u(), 0, 0, 0);
+    const u64 first_counter = state.candidate_counter;
+    std::vector<Ellipse>& candidates = state.batch;
+    std::vector<i64>& deltas = state.batch_deltas;
+
+    const bool timed = deadline != std::chrono::steady_clock::time_point::max();
+    while (current_mutation < state.config.mutations) {
+        if (timed && std::chrono::steady_clock::now() >= deadline) {
+            if (first_hit) state.shapes.push_back(best_fit);
+            return false;
+        }
+        // mutate the best fit, start over with random ellipses until one of them improved the canvas
+        auto next_candidate = [&](u32 i) {
+            Rng rng(state.config.seed, state.candidate_counter + i);
+            if (!first_hit) return RandomCandidate(state, rng);
+            Ellipse e = best_fit;
+            e.Mutate(width, height, rng);
+            return e;
+        };
+        const Ellipse first = next_candidate(0);
+        const bool batch = UseCandidateBatch(state, first);
+        const int count = batch ? state.config.batch_size : 1;
+        candidates.assign(count, first);
+        deltas.resize(count);
+        #pragma omp parallel for schedule(dynamic) if(batch)
+        for (int i = 0; i < count; ++i) {
+            if (i > 0) {
+                TRACE_SCOPE("candidate");
+                candidates[i] = next_candidate(i);
+            }
+            TRACE_SCOPE("fitness");
+            deltas[i] = EvaluateCandidate(state, candidates[i], !batch);
+        }
+        state.candidate_counter += count;
+        metrics.mutations.Add(count);
+        const int best = std::min_element(deltas.begin(), deltas.end()) - deltas.begin();
+
+        if (deltas[best] < 0) {
+            TRACE_SCOPE("commit");
+            const Ellipse& e = candidates[best];
+            const EllipseRaster raster(width, height, e);
+            // the previous best fit got replaced, its footprint shows the last generation again
+            if (first_hit) {
+                const EllipseRaster best_raster(width, height, best_fit);
+                RestoreRegion(canvas, best_raster.box, state.backup);
+                state.dirty = Union(state.dirty, best_raster.box);
+                UpdateError(state, canvas, best_raster);
+            }
+            SaveRegion(canvas, raster.box, state.backup);
+            DrawEllipse(canvas, raster, e.color);
+            state.dirty = Union(state.dirty, raster.box);
+            UpdateError(state, canvas, raster);
+            best_fit = e;
+            first_hit = true;
+            metrics.accepts.Add(1);
+        }
+        if (first_hit) {
+            current_mutation += count;
+        } else {
+            metrics.restarts.Add(count);
+            if (state.candidate_counter - first_counter >= state.config.restart_limit) {
+                // nothing left to improve, e.g. static regions of a warm started frame
+                metrics.generations.Add(1);
+                return true;
+            }
+        }
+    }
+    state.shapes.push_back(best_fit);
+    metrics.generations.Add(1);
+    return true;
+}
+
+// Deadline budget_ms from now, no deadline for 0
+inline std::chrono::steady_clock::time_point BudgetDeadline(double budget_ms) {
+    if (budget_ms <= 0) return std::chrono::steady_clock::time_point::max();
+    return std::chrono::steady_clock::now() +
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               std::chrono::duration<double, std::milli>(budget_ms));
+}
+
+// Anytime evolution: runs up to gen_limit generations on canvas and stops early at the deadline, which is checked
+// before every mutation, or batch of mutations. canvas holds the best result so far at any point, a generation cut
+// short keeps its best fit but does not count.
+inline EvolveResult Evolve(EvoState& state, ImageView canvas, u32 gen_limit,
+                           std::chrono::steady_clock::time_point deadline =
+                               std::chrono::steady_clock::time_point::max()) {
+    EvolveResult result;
+    const u64 first_counter = state.candidate_counter;
+    while (result.generations < gen_limit) {
+        if (!NextGeneration(state, canvas, deadline)) {
+            result.expired = true;
+            break;
+        }
+        result.generations++;
+    }
+    result.mutations = state.candidate_counter - first_counter;
+    return result;
+}
+
+inline void RenderShapes(ImageView canvas, const std::vector<Ellipse>& shapes) {
+    TRACE_SCOPE("render");
+    for (const Ellipse& e : shapes) DrawEllipse(canvas, EllipseRaster(canvas.width, canvas.height, e), e.color);
+}
+
+// Sums |original - canvas| over the tiles of sampler into tile_error, what sampler.tile_error holds for this canvas
+inline void TileErrors(const ErrorSampler& sampler, ConstImageView original, ConstImageView canvas,
+                       std::vector<i64>& tile_error) {
+    constexpr int tile_size = ErrorSampler::tile_size;
+    tile_error.assign(sampler.tile_error.size(), 0);
+    #pragma omp parallel for
+    for (int ty = 0; ty < sampler.tiles_y; ++ty) {
+        i64* tiles = tile_error.data() + u64(ty) * sampler.tiles_x;
+        for (int y = ty * tile_size; y < std::min(sampler.height, (ty + 1) * tile_size); ++y) {
+            const u8* original_row = original.Row(y);
+            const u8* row = canvas.Row(y);
+            for (int x = 0; x < sampler.width; ++x) {
+                for (int ch = 0; ch < 3; ++ch) {
+                    tiles[x / tile_size] += std::abs(int(original_row[x * 3 + ch]) - int(row[x * 3 + ch]));
+                }
+            }
+        }
+    }
+}
+
+// Evolves out_frame, of the size of frame, towards frame until gen_limit generations or the budget for the whole frame
+// run out. last_tile_error carries the tile errors from one frame to the next for the warm start.
+inline EvolveResult EvolveFrame(EvoState& state, ConstImageView frame, ImageView out_frame, u32 gen_limit,
+                                double budget_ms, std::vector<i64>& last_tile_error) {
+    TRACE_SCOPE("frame");
+    const ScopedLatency latency(Metrics().frame_latency);
+    const auto deadline = BudgetDeadline(budget_ms);
+    InitBackground(state.config.background, frame, out_frame, state.background_scratch);
+    u32 generations = gen_limit;
+    // the tiles to re-evolve come from the error sampler, without it every frame starts cold
+    const bool warm = state.config.warm_threshold > 0 && state.config.error_sampling && !state.shapes.empty() &&
+                      state.width == frame.width && state.height == frame.height &&
+                      last_tile_error.size() == state.sampler.tile_error.size();
+    if (warm) {
+        state.background.Create(frame.width, frame.height);
+        CopyImage(out_frame, state.background.View());
+        RenderShapes(out_frame, state.shapes);
+
+        // only tiles the previous shapes no longer fit get evolved further. The tiles are compared on the canvas of
+        // the previous frame with all of its shapes, so that only changes of the video count.
+        std::vector<i64>& tile_error = state.frame_tile_error;
+        TileErrors(state.sampler, frame, out_frame, tile_error);
+        std::vector<u8>& changed = state.changed_tiles;
+        changed.resize(tile_error.size());
+        u32 changed_count = 0;
+        const double threshold = state.config.warm_threshold * ErrorSampler::tile_size * ErrorSampler::tile_size * 3;
+        for (u32 tile = 0; tile < changed.size(); ++tile) {
+            changed[tile] = tile_error[tile] - last_tile_error[tile] > threshold;
+            changed_count += changed[tile];
+        }
+
+        if (changed.empty() || changed_count * 2 > changed.size()) {
+            // most likely a scene cut, start over
+            CopyImage(state.background.View(), out_frame);
+            state.shapes.clear();
+            InitState(state, out_frame, frame);
+        } else {
+            // The bottom most shapes are the most likely to be covered by now. Their tiles do not count as changed,
+            // this frame evolves and the next one compares against the canvas without them.
+            const u32 max_shapes = 2 * gen_limit;
+            if (state.shapes.size() > max_shapes) {
+                state.shapes.erase(state.shapes.begin(), state.shapes.end() - max_shapes);
+                CopyImage(state.background.View(), out_frame);
+                RenderShapes(out_frame, state.shapes);
+            }
+            InitState(state, out_frame, frame);
+            generations = (u64(gen_limit) * changed_count + changed.size() - 1) / changed.size();
+            state.sampler.SetActive(changed);
+        }
+    } else {
+        state.shapes.clear();
+        InitState(state, out_frame, frame);
+    }
+
+    const EvolveResult result = Evolve(state, out_frame, generations, deadline);
+    last_tile_error = state.sampler.tile_error;
+    Metrics().frames.Add(1);
+    return result;
+}
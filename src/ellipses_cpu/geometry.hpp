@@ -4,12 +4,8 @@
 #include <ostream>
 #include <random>
 #include <algorithm>
-#include <cstdint>
 
-using u8  = uint8_t;
-using u16 = uint16_t;
-using u32 = uint32_t;
-using u64 = uint64_t;
+#include "types.hpp"
 
 template <typename T>
 struct Vec2 {
@@ -26,6 +22,48 @@ using Vec2f = Vec2<float>;
 using Vec2i = Vec2<int>;
 using Vec2u = Vec2<uint32_t>;
 
+// xoshiro256** generator. Every (seed, stream) pair is expanded with splitmix64 into its own state, which makes
+// the streams cheap enough to derive one per candidate from a running counter. The results then only depend on
+// the seed and the counter, not on which thread draws them. The distributions are implemented here as the ones of
+// the standard library differ between implementations.
+struct Rng {
+    u64 s[4];
+
+    explicit Rng(u64 seed, u64 stream = 0) {
+        u64 x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+        for (u64& word : s) {
+            x += 0x9E3779B97F4A7C15ull;
+            u64 z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static u64 Rotl(u64 x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    u64 Next() {
+        const u64 result = Rotl(s[1] * 5, 7) * 9;
+        const u64 t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = Rotl(s[3], 45);
+        return result;
+    }
+
+    // uniform in [low, high]
+    int Int(int low, int high) { return low + int(((Next() >> 32) * u64(high - low + 1)) >> 32); }
+
+    // uniform in [0, bound)
+    u64 Below(u64 bound) { return u64((unsigned __int128)Next() * bound >> 64); }
+
+    // uniform in [low, high)
+    double Real(double low, double high) { return low + (Next() >> 11) * 0x1.0p-53 * (high - low); }
+};
+
 struct Ellipse {
     Vec2u origin;
     int major, minor;
@@ -33,17 +71,13 @@ struct Ellipse {
     Color color;
     Ellipse(Vec2u origin, int major, int minor, float angle)
         : origin(origin), major(major), minor(minor), angle(angle), color(Color()){};
-    void Mutate(int w, int h) {
-        static std::default_random_engine e(std::time(nullptr));
-        static std::uniform_real_distribution<> rand_angle(-5, 5);
-        static std::uniform_int_distribution<> rand_origin(-10, 10);
-        static std::uniform_int_distribution<> rand_axes(-10, 10);
-        origin.x = std::clamp(int(origin.x) + rand_origin(e), 0, w);
-        origin.y = std::clamp(int(origin.y) + rand_origin(e), 0, h);
-        int d1 = rand_axes(e) + major, d2 = rand_axes(e) + minor;
+    void Mutate(int w, int h, Rng& rng) {
+        origin.x = std::clamp(int(origin.x) + rng.Int(-10, 10), 0, w - 1);
+        origin.y = std::clamp(int(origin.y) + rng.Int(-10, 10), 0, h - 1);
+        int d1 = rng.Int(-10, 10) + major, d2 = rng.Int(-10, 10) + minor;
         if (d1 >= 0) major = d1;
         if (d2 >= 0) minor = d2;
-        angle = rand_angle(e);
+        angle = rng.Real(-5, 5);
     }
 };
 
@@ -61,10 +95,9 @@ struct Ellipse {
 //    return 0;
 //}
 
-Ellipse RandomEllipse(int max_width, int max_height) {
-    static std::default_random_engine e(std::time(nullptr));
-    static std::uniform_real_distribution<> rand_angle(-5, 5);
-    static std::uniform_int_distribution<> rand_origin(0, std::min(max_width, max_height));
-    static std::uniform_int_distribution<> rand_axes(0, std::min(max_width, max_height) / 2);
-    return Ellipse(Vec2u(rand_origin(e), rand_origin(e)), rand_axes(e), rand_axes(e), rand_angle(e));
+inline Ellipse RandomEllipse(int max_width, int max_height, Rng& rng) {
+    const int size = std::min(max_width, max_height);
+    const u32 x = rng.Int(0, max_width - 1), y = rng.Int(0, max_height - 1);
+    const int major = rng.Int(0, size / 2), minor = rng.Int(0, size / 2);
+    return Ellipse(Vec2u(x, y), major, minor, rng.Real(-5, 5));
 }
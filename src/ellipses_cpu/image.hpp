@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "types.hpp"
+
+// BGR24 image in memory owned elsewhere. Rows may be padded, pixel (x, y) starts at Row(y) + x * 3.
+template <typename T>
+struct BasicImageView {
+    T* data = nullptr;
+    int width = 0, height = 0;
+    // bytes from the start of one row to the next, at least width * 3
+    u64 stride = 0;
+
+    BasicImageView() = default;
+    BasicImageView(T* data, int width, int height, u64 stride)
+        : data(data), width(width), height(height), stride(stride) {}
+
+    // a writable view converts to a read only one
+    template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T>>>
+    BasicImageView(const BasicImageView<U>& view)
+        : data(view.data), width(view.width), height(view.height), stride(view.stride) {}
+
+    T* Row(int y) const { return data + u64(y) * stride; }
+
+    bool Empty() const { return !data || width <= 0 || height <= 0; }
+};
+
+using ImageView = BasicImageView<u8>;
+using ConstImageView = BasicImageView<const u8>;
+
+// BGR24 image with tightly packed rows
+class Image {
+public:
+    Image() = default;
+    Image(int width, int height) { Create(width, height); }
+
+    // keeps the memory if the size did not grow
+    void Create(int w, int h) {
+        width = w;
+        height = h;
+        pixels.resize(u64(w) * h * 3);
+    }
+
+    ImageView View() { return {pixels.data(), width, height, u64(width) * 3}; }
+    ConstImageView View() const { return {pixels.data(), width, height, u64(width) * 3}; }
+
+    int width = 0, height = 0;
+
+private:
+    std::vector<u8> pixels;
+};
+
+// src and dst must have the same size
+inline void CopyImage(ConstImageView src, ImageView dst) {
+    for (int y = 0; y < src.height; ++y) std::memcpy(dst.Row(y), src.Row(y), u64(src.width) * 3);
+}
@@ -0,0 +1,164 @@
+#include "imageevo.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <new>
+
+#include "engine.hpp"
+#include "geometry.hpp"
+
+struct ImageEvoEngine {
+    Engine engine;
+    int threads = 0;
+    // channel order of the last target, the colors of the shapes are in it
+    bool rgb = false;
+    // packed 24 bit copies for the targets and outputs the engine cannot work on where they are
+    Image target, output;
+};
+
+static u32 BytesPerPixel(ImageEvoPixelFormat format) {
+    return format == IMAGEEVO_BGRA32 || format == IMAGEEVO_RGBA32 ? 4 : 3;
+}
+
+static bool IsRgb(ImageEvoPixelFormat format) { return format == IMAGEEVO_RGB24 || format == IMAGEEVO_RGBA32; }
+
+static bool ValidImage(const ImageEvoImage* image) {
+    return image && image->data && image->width > 0 && image->height > 0 && image->format >= IMAGEEVO_BGR24 &&
+           image->format <= IMAGEEVO_RGBA32 && image->stride >= u64(image->width) * BytesPerPixel(image->format);
+}
+
+// one past the last pixel byte of image
+static const u8* ImageEnd(const ImageEvoImage& image) {
+    return image.data + u64(image.height - 1) * image.stride + u64(image.width) * BytesPerPixel(image.format);
+}
+
+static bool Overlap(const ImageEvoImage& a, const ImageEvoImage& b) {
+    return a.data < ImageEnd(b) && b.data < ImageEnd(a);
+}
+
+static ImageEvoImage PackedImage(ImageView view, ImageEvoPixelFormat format) {
+    return {view.data, view.width, view.height, view.stride, format};
+}
+
+// Copies src into dst of the same size and another format, which must not overlap
+static void ConvertImage(const ImageEvoImage& src, const ImageEvoImage& dst) {
+    const u32 src_bytes = BytesPerPixel(src.format), dst_bytes = BytesPerPixel(dst.format);
+    const bool swap = IsRgb(src.format) != IsRgb(dst.format);
+    #pragma omp parallel for
+    for (int y = 0; y < src.height; ++y) {
+        const u8* from = src.data + u64(y) * src.stride;
+        u8* to = dst.data + u64(y) * dst.stride;
+        for (int x = 0; x < src.width; ++x, from += src_bytes, to += dst_bytes) {
+            to[0] = from[swap ? 2 : 0];
+            to[1] = from[1];
+            to[2] = from[swap ? 0 : 2];
+            if (dst_bytes == 4) to[3] = 255;
+        }
+    }
+}
+
+// the values themselves get checked by ConfigError
+static bool ToEvoConfig(const ImageEvoConfig& from, EvoConfig& config) {
+    if (from.fitness < IMAGEEVO_FITNESS_L1 || from.fitness > IMAGEEVO_FITNESS_L2) return false;
+    if (from.parallelism < IMAGEEVO_PARALLELISM_AUTO || from.parallelism > IMAGEEVO_PARALLELISM_CANDIDATES) {
+        return false;
+    }
+    if (from.threads < 0) return false;
+    config.fitness = from.fitness == IMAGEEVO_FITNESS_L2 ? Fitness::L2 : Fitness::L1;
+    config.parallelism = from.parallelism == IMAGEEVO_PARALLELISM_PIXELS       ? Parallelism::Pixels
+                         : from.parallelism == IMAGEEVO_PARALLELISM_CANDIDATES ? Parallelism::Candidates
+                                                                               : Parallelism::Auto;
+    config.background = Background(from.background);
+    config.seed = from.seed;
+    config.screen_level = from.screen_level;
+    config.screen_margin = from.screen_margin;
+    config.error_sampling = from.error_sampling;
+    config.mutations = from.mutations;
+    config.warm_threshold = from.warm_threshold;
+    return true;
+}
+
+void imageevo_default_config(ImageEvoConfig* config) {
+    if (!config) return;
+    const EvoConfig defaults;
+    config->fitness = defaults.fitness == Fitness::L2 ? IMAGEEVO_FITNESS_L2 : IMAGEEVO_FITNESS_L1;
+    config->parallelism = IMAGEEVO_PARALLELISM_AUTO;
+    // unlike the command line, the default does not go through OpenCV, so frames do not allocate
+    config->background = IMAGEEVO_BACKGROUND_HISTOGRAM_MEDIAN;
+    config->seed = defaults.seed;
+    config->screen_level = defaults.screen_level;
+    config->screen_margin = defaults.screen_margin;
+    config->error_sampling = defaults.error_sampling;
+    config->mutations = defaults.mutations;
+    config->warm_threshold = defaults.warm_threshold;
+    config->threads = 0;
+}
+
+ImageEvoEngine* imageevo_create(const ImageEvoConfig* config) {
+    ImageEvoConfig settings;
+    imageevo_default_config(&settings);
+    if (config) settings = *config;
+    EvoConfig evo_config;
+    if (!ToEvoConfig(settings, evo_config) || ConfigError(evo_config)) return nullptr;
+    try {
+        std::unique_ptr<ImageEvoEngine> engine(new ImageEvoEngine());
+        engine->engine = Engine(evo_config);
+        engine->threads = settings.threads;
+        return engine.release();
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void imageevo_destroy(ImageEvoEngine* engine) { delete engine; }
+
+ImageEvoStatus imageevo_evolve_frame(ImageEvoEngine* engine, const ImageEvoImage* target, const ImageEvoImage* output,
+                                     uint32_t gen_limit, double budget_ms, ImageEvoResult* result) {
+    if (!engine || !ValidImage(target) || !ValidImage(output) || target->width != output->width ||
+        target->height != output->height || !std::isfinite(budget_ms) || budget_ms < 0) {
+        return IMAGEEVO_INVALID_ARGUMENT;
+    }
+    if (engine->threads > 0) omp_set_num_threads(engine->threads);
+    const int width = target->width, height = target->height;
+    // the engine is indifferent to the channel order, it works in the one of the target
+    const ImageEvoPixelFormat packed = IsRgb(target->format) ? IMAGEEVO_RGB24 : IMAGEEVO_BGR24;
+    try {
+        // the engine writes the background of the frame first, a target overlapping the output gets copied before
+        ConstImageView frame(target->data, width, height, target->stride);
+        if (target->format != packed || Overlap(*target, *output)) {
+            engine->target.Create(width, height);
+            ConvertImage(*target, PackedImage(engine->target.View(), packed));
+            frame = engine->target.View();
+        }
+        const bool direct = output->format == packed;
+        ImageView out(output->data, width, height, output->stride);
+        if (!direct) {
+            engine->output.Create(width, height);
+            out = engine->output.View();
+        }
+
+        const EvolveResult evolved = engine->engine.EvolveFrame(frame, out, gen_limit, budget_ms);
+        if (!direct) ConvertImage(PackedImage(out, packed), *output);
+        engine->rgb = IsRgb(packed);
+        if (result) *result = {evolved.generations, evolved.mutations, evolved.expired};
+    } catch (const std::bad_alloc&) {
+        return IMAGEEVO_OUT_OF_MEMORY;
+    }
+    return IMAGEEVO_OK;
+}
+
+size_t imageevo_shapes(const ImageEvoEngine* engine, ImageEvoShape* shapes, size_t capacity) {
+    if (!engine) return 0;
+    const std::vector<Ellipse>& all = engine->engine.Shapes();
+    if (!shapes) capacity = 0;
+    for (size_t i = 0; i < std::min(capacity, all.size()); ++i) {
+        const Ellipse& e = all[i];
+        // Color holds the channels in the byte order of the target
+        const u8 r = engine->rgb ? e.color.r : e.color.b, b = engine->rgb ? e.color.b : e.color.r;
+        shapes[i] = {e.origin.x, e.origin.y, e.major, e.minor, e.angle, r, e.color.g, b};
+    }
+    return all.size();
+}
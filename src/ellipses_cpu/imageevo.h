@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface of libimageevo for hosts that run the evolution as a filter on their own frame buffers. The engine
+// works on the buffers of the caller wherever the layout allows it and keeps its memory from one call to the next, so
+// a loop over frames of the same size does not allocate once the first frame went through.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ImageEvoStatus {
+    IMAGEEVO_OK = 0,
+    // a null pointer, an unknown enum value, an empty image, a stride below the row size or images of different sizes
+    IMAGEEVO_INVALID_ARGUMENT = 1,
+    IMAGEEVO_OUT_OF_MEMORY = 2,
+} ImageEvoStatus;
+
+// Byte order of the pixels. The alpha channel of the 32 bit formats is ignored in the target and set to 255 in the
+// output.
+typedef enum ImageEvoPixelFormat {
+    IMAGEEVO_BGR24 = 0,
+    IMAGEEVO_RGB24 = 1,
+    IMAGEEVO_BGRA32 = 2,
+    IMAGEEVO_RGBA32 = 3,
+} ImageEvoPixelFormat;
+
+typedef enum ImageEvoFitness { IMAGEEVO_FITNESS_L1 = 0, IMAGEEVO_FITNESS_L2 = 1 } ImageEvoFitness;
+
+typedef enum ImageEvoParallelism {
+    IMAGEEVO_PARALLELISM_AUTO = 0,
+    IMAGEEVO_PARALLELISM_PIXELS = 1,
+    IMAGEEVO_PARALLELISM_CANDIDATES = 2,
+} ImageEvoParallelism;
+
+// The medians need OpenCV in the library, without it they fall back to IMAGEEVO_BACKGROUND_HISTOGRAM_MEDIAN. The
+// OpenCV medians allocate on every frame, the others work in buffers of the engine.
+typedef enum ImageEvoBackground {
+    IMAGEEVO_BACKGROUND_MEDIAN = 0,
+    IMAGEEVO_BACKGROUND_BOX = 1,
+    IMAGEEVO_BACKGROUND_GAUSSIAN = 2,
+    IMAGEEVO_BACKGROUND_DOWNSAMPLE_MEDIAN = 3,
+    IMAGEEVO_BACKGROUND_MEAN = 4,
+    IMAGEEVO_BACKGROUND_HISTOGRAM_MEDIAN = 5,
+} ImageEvoBackground;
+
+// imageevo_default_config fills in the defaults
+typedef struct ImageEvoConfig {
+    // L2 scores shapes from the prefix sums and fills them with their mean color
+    ImageEvoFitness fitness;
+    // PIXELS evaluates one candidate at a time with all threads, CANDIDATES a batch with one candidate per thread,
+    // AUTO picks by the size of the candidate
+    ImageEvoParallelism parallelism;
+    // initial canvas of every frame, HISTOGRAM_MEDIAN by default, which does not allocate
+    ImageEvoBackground background;
+    // seed of the candidate streams, the same seed and frames give the same shapes
+    uint64_t seed;
+    // L1 candidates are screened on the pyramid level 1 / 2^screen_level first, 0 to 4, 0 disables the screening
+    int screen_level;
+    double screen_margin;
+    // nonzero places new shapes proportionally to the error of the canvas instead of uniformly
+    int error_sampling;
+    // candidates a generation evaluates once it found an improvement, at least 1
+    int mutations;
+    // re-evolve tiles whose error rose by more than this per channel and pixel, 0 starts every frame from scratch.
+    // Needs error_sampling, without it every frame starts from scratch as well.
+    double warm_threshold;
+    // OpenMP threads of the calling thread, 0 keeps the current setting
+    int threads;
+} ImageEvoConfig;
+
+// Pixel (x, y) starts at data + y * stride + x * bytes per pixel. Rows may be padded.
+typedef struct ImageEvoImage {
+    uint8_t* data;
+    int width, height;
+    size_t stride;
+    ImageEvoPixelFormat format;
+} ImageEvoImage;
+
+typedef struct ImageEvoResult {
+    uint32_t generations;
+    uint64_t mutations;
+    // the budget ended the frame before the generation limit
+    int expired;
+} ImageEvoResult;
+
+// Ellipse in pixel coordinates of the frame, angle in radians
+typedef struct ImageEvoShape {
+    uint32_t x, y;
+    int32_t major, minor;
+    double angle;
+    uint8_t r, g, b;
+} ImageEvoShape;
+
+typedef struct ImageEvoEngine ImageEvoEngine;
+
+void imageevo_default_config(ImageEvoConfig* config);
+
+// Returns null if config is invalid or there is no memory. config == null uses the defaults.
+ImageEvoEngine* imageevo_create(const ImageEvoConfig* config);
+void imageevo_destroy(ImageEvoEngine* engine);
+
+// Evolves output towards target as the next frame of a stream, see Engine::EvolveFrame. Both have the same size, the
+// formats may differ. output may be target itself to filter in place. BGR24 and RGB24 targets are read where they
+// are, an output of the same 24 bit format is evolved where it is, everything else goes through buffers of the
+// engine. budget_ms limits the whole frame, 0 for no limit, it must be finite. result may be null.
+ImageEvoStatus imageevo_evolve_frame(ImageEvoEngine* engine, const ImageEvoImage* target, const ImageEvoImage* output,
+                                     uint32_t gen_limit, double budget_ms, ImageEvoResult* result);
+
+// Copies up to capacity shapes of the last frame in drawing order into shapes and returns how many there are
+size_t imageevo_shapes(const ImageEvoEngine* engine, ImageEvoShape* shapes, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
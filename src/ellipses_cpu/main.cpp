@@ -1,202 +1,385 @@
-#include <SDL.h>
-
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 #include <omp.h>
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "engine.hpp"
 #include "geometry.hpp"
+#include "mat_view.hpp"
+#include "metrics.hpp"
+#include "perf.hpp"
+#include "pipeline.hpp"
+#include "raster.hpp"
+#include "sink.hpp"
+#include "source.hpp"
+#include "trace.hpp"
+
+// the SDL preview is optional, without it only the headless and video modes are available
+#ifndef IMAGE_EVO_SDL
+#define IMAGE_EVO_SDL 1
+#endif
+
+#if IMAGE_EVO_SDL
+#include <SDL.h>
+#endif
 
 #define USE_EDGE_DETECTION false
 #define SCALE_FACTOR 2
 
-void Render(SDL_Renderer* renderer, SDL_Texture* texture, cv::Mat& buffer) {
+#if IMAGE_EVO_SDL
+void Render(SDL_Renderer* renderer, SDL_Texture* texture) {
+    TRACE_SCOPE("present");
     SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
     SDL_RenderClear(renderer);
-
-    int pitch = 0;
-    u8* displayPtr = nullptr;
-    SDL_LockTexture(texture, nullptr, (void**)&displayPtr, &pitch);
-    std::memcpy(displayPtr, buffer.data, buffer.total() * buffer.elemSize());
-    SDL_UnlockTexture(texture);
-
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
 }
+#endif
 
-void DrawEllipse(int width, int height, cv::Mat& buffer, Ellipse& e) {
-    const int bb = std::max(e.major, e.minor);
-    const auto start_y = std::max<u32>(0, e.origin.y - bb), end_y = std::min<u32>(height, e.origin.y + bb);
-    const auto start_x = std::max<u32>(0, e.origin.x - bb), end_x = std::min<u32>(width, e.origin.x + bb);
-
-    const double cos = std::cos(e.angle), sin = std::sin(e.angle);
-    const double pow_major = std::pow(e.major, 2), pow_minor = std::pow(e.minor, 2);
-
-    #pragma omp parallel for collapse(2)
-    for (u32 y = start_y; y < end_y; ++y) {
-        for (u32 x = start_x; x < end_x; ++x) {
-            int xc = (int)x - (int)e.origin.x;
-            int yc = (int)y - (int)e.origin.y;
-            if ((std::pow((xc * cos - yc * sin), 2) / pow_major +
-                 std::pow((xc * sin + yc * cos), 2) / pow_minor) <= 1.0) {
-                u32 index = (x + y * width) * 3;
-                buffer.data[index] = e.color.r;
-                buffer.data[index + 1] = e.color.g;
-                buffer.data[index + 2] = e.color.b;
-            }
-        }
+void CopyRegion(const cv::Mat& src, cv::Mat& dst, const BoundingBox& box) {
+    if (box.Empty()) return;
+    for (int y = box.start_y; y < box.end_y; ++y) {
+        std::memcpy(dst.ptr(y) + box.start_x * 3, src.ptr(y) + box.start_x * 3, (box.end_x - box.start_x) * 3);
     }
 }
 
-void NextGeneration(int width, int height, cv::Mat& last_gen, const u8* original) {
-    cv::Mat new_gen = last_gen.clone();
-    int current_mutation = 0;
-    double current_score = 0.0, last_score = 0.0;
-    bool first_hit = false;
-
-    Ellipse e = RandomEllipse(width, height);
-    e.color.r = original[(e.origin.y * width + e.origin.x) * 3];
-    e.color.g = original[(e.origin.y * width + e.origin.x) * 3 + 1];
-    e.color.b = original[(e.origin.y * width + e.origin.x) * 3 + 2];
-    Ellipse best_fit = e;
-
-    while (current_mutation < 500) {
-        const int bb = std::max(e.major, e.minor);
-        const auto start_y = std::max<u32>(0, e.origin.y - bb), end_y = std::min<u32>(height, e.origin.y + bb);
-        const auto start_x = std::max<u32>(0, e.origin.x - bb), end_x = std::min<u32>(width, e.origin.x + bb);
-
-        const double cos = std::cos(e.angle), sin = std::sin(e.angle);
-        const double pow_major = std::pow(e.major, 2), pow_minor = std::pow(e.minor, 2);
-
-        #pragma omp parallel for collapse(2) reduction(+:current_score, last_score)
-        for (u32 y = start_y; y < end_y; ++y) {
-            for (u32 x = start_x; x < end_x; ++x) {
-                Color new_color;
-                const int xc = (int)x - (int)e.origin.x;
-                const int yc = (int)y - (int)e.origin.y;
-                const u32 index = (x + y * width) * 3;
-                if ((std::pow((xc * cos - yc * sin), 2) / pow_major +
-                     std::pow((xc * sin + yc * cos), 2) / pow_minor) <= 1.0) {
-                    new_color = e.color;
-                } else {
-                    new_color.r = new_gen.data[index];
-                    new_color.g = new_gen.data[index + 1];
-                    new_color.b = new_gen.data[index + 2];
-                }
+// Canvas as published to the preview. dirty covers every pixel that changed since the snapshot the preview took
+// before this one, including the snapshots it never got to see.
+struct CanvasSnapshot {
+    cv::Mat canvas;
+    BoundingBox dirty = {0, 0, 0, 0};
+    int generation = 0;
+};
+
+// Evolution side of the preview. Every buffer of the triple buffer only gets the region copied that changed since
+// the buffer was last written, so publishing costs about as much as the generation touched.
+class SnapshotPublisher {
+public:
+    // the preview must show canvas already
+    SnapshotPublisher(TripleBuffer<CanvasSnapshot>& snapshots, const cv::Mat& canvas) : snapshots(snapshots) {
+        for (u32 i = 0; i < 3; ++i) snapshots[i].canvas = canvas.clone();
+    }
 
-                current_score += std::abs(int(original[index]) - int(new_color.r));
-                current_score += std::abs(int(original[index + 1]) - int(new_color.g));
-                current_score += std::abs(int(original[index + 2]) - int(new_color.b));
+    // changed is the region of canvas changed since the last call
+    void Publish(const cv::Mat& canvas, const BoundingBox& changed, int generation) {
+        TRACE_SCOPE("publish");
+        for (BoundingBox& box : stale) box = Union(box, changed);
+        const u32 back = snapshots.BackIndex();
+        CanvasSnapshot& snapshot = snapshots.Back();
+        CopyRegion(canvas, snapshot.canvas, stale[back]);
+        stale[back] = {0, 0, 0, 0};
+
+        // the preview took the snapshot before the last one or, if that one got dropped, the same as back then
+        snapshot.dirty = Union(changed, before_last_taken ? last_changed : last_dirty);
+        snapshot.generation = generation;
+        last_changed = changed;
+        last_dirty = snapshot.dirty;
+        before_last_taken = snapshots.Publish();
+    }
 
-                last_score += std::abs(int(original[index]) - int(new_gen.data[index]));
-                last_score += std::abs(int(original[index + 1]) - int(new_gen.data[index + 1]));
-                last_score += std::abs(int(original[index + 2]) - int(new_gen.data[index + 2]));
-            }
-        }
+private:
+    TripleBuffer<CanvasSnapshot>& snapshots;
+    BoundingBox stale[3] = {};
+    BoundingBox last_changed = {0, 0, 0, 0}, last_dirty = {0, 0, 0, 0};
+    bool before_last_taken = true;
+};
+
+struct VideoFrame {
+    u32 index = 0;
+    // an empty frame marks the end of the video
+    cv::Mat frame, out_frame;
+    // pool buffers behind frame and out_frame, released once the frame is written
+    u32 buffer = 0, out_buffer = 0;
+    EvolveResult result;
+};
+
+// Reads the next frame into a pooled buffer and takes the buffer for its output from out_pool, so that only the
+// decoder acquires from either pool. Returns false once there are no frames left.
+bool DecodeFrame(FrameSource& source, FramePool& pool, FramePool& out_pool, VideoFrame& item) {
+    TRACE_SCOPE("decode");
+    item.buffer = pool.Acquire();
+    item.frame = pool.Frame(item.buffer);
+    item.out_buffer = out_pool.Acquire();
+    item.out_frame = out_pool.Frame(item.out_buffer);
+    if (source.Read(item.frame)) return true;
+    // the buffers are not released here, only the encoder returns buffers to the pools
+    item.frame = cv::Mat();
+    return false;
+}
+
+void PrintFrameResult(const VideoFrame& item) {
+    printf("Finished frame %u after %u generations, %llu mutations%s\n", item.index, item.result.generations,
+           (unsigned long long)item.result.mutations, item.result.expired ? ", out of time" : "");
+}
 
-        current_score /= (bb * bb * 3);
-        last_score /= (bb * bb * 3);
+// Upscales an evolved frame into scaled, which the encoder reuses for every frame, and hands it to the sink
+bool EncodeFrame(const VideoFrame& item, FrameSink& sink, cv::Mat& scaled) {
+    TRACE_SCOPE("encode");
+    const cv::Mat* out_frame = &item.out_frame;
+    if constexpr (SCALE_FACTOR > 1) {
+        TRACE_SCOPE("resize");
+        const cv::Size size(item.out_frame.cols * SCALE_FACTOR, item.out_frame.rows * SCALE_FACTOR);
+        cv::resize(item.out_frame, scaled, size);
+        out_frame = &scaled;
+    }
+    if (sink.Write(item.index, *out_frame)) return true;
+    printf("Failed to write frame %u\n", item.index);
+    return false;
+}
 
-        if (current_score < last_score) {
-            std::memcpy(new_gen.data, last_gen.data, last_gen.total() * last_gen.elemSize());
-            DrawEllipse(width, height, new_gen, e);
-            best_fit = e;
-            first_hit = true;
+// Converts the frames in three pipelined stages: a decoder thread, the evolution on the calling thread with its
+// OpenMP workers, and an encoder thread. The stages are connected by bounded queues, so decoding and encoding are
+// hidden behind the evolution while the frames stay in order.
+u32 ConvertFramesPipelined(FrameSource& source, FramePool& pool, FramePool& out_pool, FrameSink& sink, u32 gen_limit,
+                           double budget_ms, Engine& engine, u32 frame_limit) {
+    SpscQueue<VideoFrame> decoded(4), evolved(4);
+    StageStats decode_stats{"decode"}, evolve_stats{"evolve"}, encode_stats{"encode"};
+
+    std::thread decoder([&]() {
+        TRACE_THREAD("decode");
+        for (u32 frame_counter = 0; frame_limit == 0 || frame_counter < frame_limit; ++frame_counter) {
+            VideoFrame item;
+            item.index = frame_counter;
+            bool decoded_frame = false;
+            decode_stats.Run([&]() { decoded_frame = DecodeFrame(source, pool, out_pool, item); });
+            if (!decoded_frame) break;
+            decoded.Push(std::move(item));
         }
-        current_score = 0;
-        last_score = 0;
-
-        e = best_fit;
-        e.Mutate(width, height);
-        if (first_hit) {
-            current_mutation++;
-        } else {
-            e = RandomEllipse(width, height);
-            e.color.r = original[(e.origin.y * width + e.origin.x) * 3];
-            e.color.g = original[(e.origin.y * width + e.origin.x) * 3 + 1];
-            e.color.b = original[(e.origin.y * width + e.origin.x) * 3 + 2];
-            best_fit = e;
+        decoded.Push(VideoFrame());
+        decode_stats.Finish();
+    });
+
+    u32 frame_counter = 0;
+    std::thread encoder([&]() {
+        TRACE_THREAD("encode");
+        cv::Mat scaled;
+        for (VideoFrame item = evolved.Pop(); !item.frame.empty(); item = evolved.Pop()) {
+            encode_stats.Run([&]() { EncodeFrame(item, sink, scaled); });
+            pool.Release(item.buffer);
+            out_pool.Release(item.out_buffer);
+            PrintFrameResult(item);
+            frame_counter++;
         }
+        encode_stats.Finish();
+    });
+
+    // convert frame-by-frame
+    for (VideoFrame item = decoded.Pop(); !item.frame.empty(); item = decoded.Pop()) {
+        evolve_stats.Run([&]() {
+            item.result = engine.EvolveFrame(ViewOf(item.frame), ViewOf(item.out_frame), gen_limit, budget_ms);
+        });
+        evolved.Push(std::move(item));
     }
+    evolved.Push(VideoFrame());
+    evolve_stats.Finish();
 
-    std::memcpy(last_gen.data, new_gen.data, new_gen.total() * new_gen.elemSize());
-}
+    decoder.join();
+    encoder.join();
 
-int ConvertVideo(std::string& video_path, u32 gen_limit, u32 frame_limit = 30) {
-    cv::VideoCapture capture(video_path);
-    if (!capture.isOpened()) {
-        printf("Failed to open source video from %s\n", video_path.c_str());
-        return 1;
+    for (const StageStats* stats : {&decode_stats, &evolve_stats, &encode_stats}) {
+        printf("Stage %s busy %.1f%% of %.2f s\n", stats->name, 100.0 * stats->Occupancy(), stats->total);
     }
+    printf("Queue depth decoded %.2f/%u, evolved %.2f/%u\n", decoded.AverageDepth(), decoded.Capacity(),
+           evolved.AverageDepth(), evolved.Capacity());
+    return frame_counter;
+}
 
-    u64 start_name = video_path.find_last_of('/');
-    std::string out_file = "_" + video_path.substr(start_name == std::string::npos ? 0 : start_name) + ".bmp";
-
-    double start = omp_get_wtime();
+// Evolves up to inflight frames at once, each by its own engine on a work stealing pool. The decoder blocks while
+// inflight frames are decoded but not yet written, which bounds the memory, and the encoder restores the frame order.
+// The frames are independent of each other, so there is no warm start here.
+u32 ConvertFramesParallel(FrameSource& source, FramePool& pool, FramePool& out_pool, FrameSink& sink, u32 gen_limit,
+                          double budget_ms, Engine& main_engine, u32 inflight, u32 frame_limit) {
+    const u32 threads = omp_get_max_threads();
+    const u32 workers = std::min(inflight, threads);
+    // the OpenMP threads are split between the engines
+    const u32 engine_threads = std::max(1u, threads / workers);
+    EvoConfig config = main_engine.Config();
+    config.warm_threshold = 0;
+    std::vector<Engine> engines;
+    for (u32 worker = 0; worker < workers; ++worker) engines.emplace_back(config);
+
+    Semaphore window(inflight);
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::map<u32, VideoFrame> done;
+    // number of decoded frames, known once the decoder is through
+    u32 frame_total = ~0u;
+
+    StageStats decode_stats{"decode"}, encode_stats{"encode"};
+    std::vector<double> evolve_seconds(workers);
 
-    // convert frame-by-frame
     u32 frame_counter = 0;
-    while (frame_counter < frame_limit) {
-        // get next frame
-        cv::Mat frame;
-        capture >> frame;
-        // no frames left
-        if (frame.empty()) break;
-
-        if constexpr (SCALE_FACTOR > 1) {
-            // downsample
-            cv::resize(frame, frame, cv::Size(frame.cols / SCALE_FACTOR, frame.rows / SCALE_FACTOR));
+    std::thread encoder([&]() {
+        TRACE_THREAD("encode");
+        cv::Mat scaled;
+        for (u32 index = 0;; ++index) {
+            VideoFrame item;
+            {
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done_cv.wait(lock, [&]() { return done.count(index) || index == frame_total; });
+                if (index == frame_total) break;
+                item = std::move(done[index]);
+                done.erase(index);
+            }
+            encode_stats.Run([&]() { EncodeFrame(item, sink, scaled); });
+            pool.Release(item.buffer);
+            out_pool.Release(item.out_buffer);
+            PrintFrameResult(item);
+            frame_counter++;
+            window.Release();
         }
-
-        // convert the frame
-        cv::Mat out_frame;
-        cv::medianBlur(frame, out_frame, 151);
-        u32 gen_ctr = 0;
-        while (gen_ctr < gen_limit) {
-            NextGeneration(frame.cols, frame.rows, out_frame, frame.data);
-            gen_ctr++;
+        encode_stats.Finish();
+    });
+
+    const double start = omp_get_wtime();
+    {
+        WorkStealingPool engine_pool(workers);
+        u32 index = 0;
+        for (; frame_limit == 0 || index < frame_limit; ++index) {
+            window.Acquire();
+            auto item = std::make_shared<VideoFrame>();
+            item->index = index;
+            bool decoded_frame = false;
+            decode_stats.Run([&]() { decoded_frame = DecodeFrame(source, pool, out_pool, *item); });
+            if (!decoded_frame) {
+                window.Release();
+                break;
+            }
+            engine_pool.Submit([&, item](u32 worker) {
+                omp_set_num_threads(engine_threads);
+                Engine& engine = engines[worker];
+                // the stream of a frame depends on its index only, not on the worker it lands on
+                engine.Reseed(Rng(config.seed, item->index).Next());
+                const double begin = omp_get_wtime();
+                item->result =
+                    engine.EvolveFrame(ViewOf(item->frame), ViewOf(item->out_frame), gen_limit, budget_ms);
+                evolve_seconds[worker] += omp_get_wtime() - begin;
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    done[item->index] = std::move(*item);
+                }
+                done_cv.notify_all();
+            });
         }
-
-        if constexpr (SCALE_FACTOR > 1) {
-            // upscale
-            cv::resize(out_frame, out_frame, cv::Size(out_frame.cols * 4, out_frame.rows * 4));
+        decode_stats.Finish();
+        {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            frame_total = index;
         }
+        done_cv.notify_all();
+    }
+    const double elapsed = omp_get_wtime() - start;
+    encoder.join();
 
-        // save frame
-        std::string frame_name = "out" + std::to_string(frame_counter) + out_file;
-        cv::imwrite(frame_name, out_frame);
-        printf("Finished frame %u\n", frame_counter);
-        frame_counter++;
+    for (const StageStats* stats : {&decode_stats, &encode_stats}) {
+        printf("Stage %s busy %.1f%% of %.2f s\n", stats->name, 100.0 * stats->Occupancy(), stats->total);
+    }
+    for (u32 worker = 0; worker < workers; ++worker) {
+        printf("Engine %u busy %.1f%% of %.2f s\n", worker, elapsed > 0 ? 100.0 * evolve_seconds[worker] / elapsed : 0,
+               elapsed);
+        main_engine.MergeStats(engines[worker]);
     }
+    return frame_counter;
+}
+
+// engine holds the configuration of the evolution, it gets reinitialized for every frame
+// output selects the sink, see CreateFrameSink, frame_limit 0 converts the whole stream
+// budget_ms limits the evolution time of every frame, see Evolve
+int ConvertVideo(FrameSource& source, const std::string& video_path, u32 gen_limit, double budget_ms, Engine& engine,
+                 u32 inflight, const std::string& output, u32 frame_limit) {
+    std::unique_ptr<FrameSink> sink = CreateFrameSink(output, video_path, source.Fps());
+    // enough buffers to fill every queue and stage, or the in-flight window plus the frames being decoded and written
+    const u32 buffers = inflight > 1 ? inflight + 2 : 12;
+    // the evolved frames get buffers of their own, which the encoder releases along with the source frame
+    FramePool pool(buffers, source.Width(), source.Height()), out_pool(buffers, source.Width(), source.Height());
+
+    double start = omp_get_wtime();
+
+    u32 frame_counter =
+        inflight > 1
+            ? ConvertFramesParallel(source, pool, out_pool, *sink, gen_limit, budget_ms, engine, inflight, frame_limit)
+            : ConvertFramesPipelined(source, pool, out_pool, *sink, gen_limit, budget_ms, engine, frame_limit);
+    // pending frames of an asynchronous sink count towards the time
+    bool written = sink->Close();
 
     double end = omp_get_wtime();
     printf("Time = %.16g\n", end - start);
 
     printf("Finished converting video with %u frames\n", frame_counter);
-    return 0;
+    engine.PrintStats();
+    if (Perf().Enabled()) Perf().Print(Metrics().generations.Value());
+    return written ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
-    // use 4 cores
-    omp_set_num_threads(4);
-    printf("ImageEvo running on %d thread(s)\n", omp_get_max_threads());
-
     //printf("%s\n", cv::getBuildInformation().c_str());
 
     cv::CommandLineParser parser(argc, argv,
                                  "{@source|<none>|path to the input image}"
                                  "{ngenerations n|1000|number of generations}"
                                  "{headless h||no window, halt after ngenerations}"
-                                 "{video v||use video as source and output}");
+                                 "{video v||use video as source and output}"
+                                 "{fitness f|l1|fitness metric, l1 or l2 (mean color fill)}"
+                                 "{budget|0|headless: time limit in ms per image or video frame, 0 for none}"
+                                 "{threads t|4|number of threads}"
+                                 "{parallel p|auto|parallelism, auto, pixels or candidates}"
+                                 "{seed s|0|random seed, 0 picks one from the clock}"
+                                 "{screen|0|screen l1 candidates on 1/2^screen resolution first, 0 disables}"
+                                 "{margin|0|error per channel and pixel a candidate must gain on the coarse level}"
+                                 "{sampling|error|placement of new ellipses, error (weighted by tile error) or uniform}"
+                                 "{warm|4|video: re-evolve tiles whose error per channel rose by this much, 0 disables}"
+                                 "{background b|median|canvas: median, box, gaussian, downmedian, mean or histmedian}"
+                                 "{output o||video: output file, - or .y4m for Y4M, empty for an image sequence}"
+                                 "{input|file|video: file (via OpenCV), y4m or raw (bgr24 of --size), - reads stdin}"
+                                 "{size||raw input frame size WxH}"
+                                 "{fps|30|raw input frame rate}"
+                                 "{frames|-1|video: frame limit, 0 for none, default 30 for files and none otherwise}"
+                                 "{inflight|1|video: frames evolved at once by separate engines, >1 disables warm}"
+                                 "{metrics||json file the counters and latency histograms are dumped to at exit}"
+                                 "{prom||prometheus text file the metrics get rewritten to periodically}"
+                                 "{prominterval|5|seconds between two prometheus dumps}"
+                                 "{perf||count cycles, cache and branch misses of the fitness and draw kernels, Linux}"
+                                 "{trace||chrome trace json written at exit, needs a build with IMAGE_EVO_TRACE}");
 
     std::string file_path = parser.get<std::string>("@source");
     int gen_limit = parser.get<int>("n");
     bool headless = parser.has("h");
     bool video = parser.has("v");
+    std::string fitness_name = parser.get<std::string>("f");
+    double budget_ms = parser.get<double>("budget");
+    int threads = parser.get<int>("t");
+    std::string parallel_name = parser.get<std::string>("p");
+    u64 seed = parser.get<u64>("s");
+    int screen_level = parser.get<int>("screen");
+    double screen_margin = parser.get<double>("margin");
+    std::string sampling_name = parser.get<std::string>("sampling");
+    double warm_threshold = parser.get<double>("warm");
+    int inflight = parser.get<int>("inflight");
+    std::string output = parser.get<std::string>("o");
+    std::string background_name = parser.get<std::string>("b");
+    std::string input = parser.get<std::string>("input");
+    std::string raw_size = parser.get<std::string>("size");
+    double raw_fps = parser.get<double>("fps");
+    int frame_limit = parser.get<int>("frames");
+    std::string metrics_path = parser.get<std::string>("metrics");
+    std::string prom_path = parser.get<std::string>("prom");
+    double prom_interval = parser.get<double>("prominterval");
+    std::string trace_path = parser.get<std::string>("trace");
+    bool perf_counters = parser.has("perf");
 
     if (file_path.empty()) {
         printf("No image specified\n");
@@ -207,28 +390,125 @@ int main(int argc, char** argv) {
         printf("Invalid generation limit %d\n", gen_limit);
         return 1;
     }
+    if (fitness_name != "l1" && fitness_name != "l2") {
+        printf("Invalid fitness metric %s\n", fitness_name.c_str());
+        return 1;
+    }
+    Fitness fitness = fitness_name == "l2" ? Fitness::L2 : Fitness::L1;
+    if (parallel_name != "auto" && parallel_name != "pixels" && parallel_name != "candidates") {
+        printf("Invalid parallelism %s\n", parallel_name.c_str());
+        return 1;
+    }
+    Parallelism parallelism = parallel_name == "pixels"       ? Parallelism::Pixels
+                              : parallel_name == "candidates" ? Parallelism::Candidates
+                                                              : Parallelism::Auto;
+    if (budget_ms < 0) {
+        printf("Invalid time budget %g\n", budget_ms);
+        return 1;
+    }
+    if (threads < 1) {
+        printf("Invalid thread count %d\n", threads);
+        return 1;
+    }
+    if (screen_level < 0 || screen_level > 4) {
+        printf("Invalid screening level %d\n", screen_level);
+        return 1;
+    }
+    if (sampling_name != "error" && sampling_name != "uniform") {
+        printf("Invalid sampling %s\n", sampling_name.c_str());
+        return 1;
+    }
+    if (inflight < 1) {
+        printf("Invalid in-flight frame count %d\n", inflight);
+        return 1;
+    }
+    int background = 0;
+    while (background < background_count && background_name != background_names[background]) background++;
+    if (background == background_count) {
+        printf("Invalid background %s\n", background_name.c_str());
+        return 1;
+    }
+    if (input != "file" && input != "y4m" && input != "raw") {
+        printf("Invalid input %s\n", input.c_str());
+        return 1;
+    }
+    int raw_width = 0, raw_height = 0;
+    if (input == "raw" && (sscanf(raw_size.c_str(), "%dx%d", &raw_width, &raw_height) != 2 || raw_width <= 0 ||
+                           raw_height <= 0 || raw_fps <= 0)) {
+        printf("Raw input requires a frame size WxH and a positive frame rate\n");
+        return 1;
+    }
+    if (input != "file" && !video) {
+        printf("Input %s is only supported for video\n", input.c_str());
+        return 1;
+    }
+    if (frame_limit < 0) frame_limit = input == "file" ? 30 : 0;
+    if (warm_threshold > 0 && video && inflight == 1 && sampling_name != "error") {
+        printf("Warm start requires error sampling\n");
+        return 1;
+    }
+    if (!prom_path.empty() && prom_interval <= 0) {
+        printf("Invalid prometheus interval %g\n", prom_interval);
+        return 1;
+    }
+    if (!trace_path.empty() && !trace_enabled) {
+        printf("Tracing requires a build with IMAGE_EVO_TRACE\n");
+        return 1;
+    }
+    if (seed == 0) seed = std::time(nullptr);
+    MetricsJsonDump metrics_dump(metrics_path);
+    std::unique_ptr<MetricsReporter> metrics_reporter;
+    if (!prom_path.empty()) metrics_reporter = std::make_unique<MetricsReporter>(prom_path, prom_interval);
+    ChromeTraceDump trace_dump(trace_path);
+    // the message about missing counters is enough, the run goes on without them
+    if (perf_counters) Perf().Enable();
+    TRACE_THREAD("main");
+    omp_set_num_threads(threads);
+    printf("ImageEvo running on %d thread(s), %s fitness kernel, seed %llu\n", omp_get_max_threads(),
+           FitnessKernelName(), (unsigned long long)seed);
+
+    EvoConfig config;
+    config.fitness = fitness;
+    config.parallelism = parallelism;
+    config.seed = seed;
+    config.screen_level = screen_level;
+    config.screen_margin = screen_margin;
+    config.error_sampling = sampling_name == "error";
+    // only a single engine on a video carries shapes from one frame to the next
+    config.warm_threshold = video && inflight == 1 ? warm_threshold : 0;
+    config.background = Background(background);
+    Engine engine(config);
+    if (!engine.IsValid()) return 1;
+
     if (video && !headless) {
         printf("Video source can only be used in headless mode\n");
         return 1;
     }
 
     if (video) {
-        int error = ConvertVideo(file_path, gen_limit);
+        std::unique_ptr<FrameSource> source =
+            CreateFrameSource(input, file_path, raw_width, raw_height, raw_fps, SCALE_FACTOR);
+        if (!source) {
+            printf("Failed to open source video from %s\n", file_path.c_str());
+            return 1;
+        }
+        int error = ConvertVideo(*source, file_path, gen_limit, budget_ms, engine, inflight, output, frame_limit);
         if (error) printf("Failed to convert video\n");
         return error;
     }
 
     cv::Mat image = cv::imread(file_path);
-    const int w = image.cols, h = image.rows, components = image.channels();
-    if (!image.data || components != 3) {
+    if (!image.data || image.channels() != 3) {
         printf("Failed to load image %s\n", file_path.c_str());
         return 1;
     }
 
-    cv::Mat buffer;
+    cv::Mat buffer(image.size(), CV_8UC3);
     //cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
     // create a blurred background as the baseline
-    cv::medianBlur(image, buffer, 151);
+    FillBackground(config.background, ViewOf(image), ViewOf(buffer));
+
+    engine.Reset(ViewOf(image), ViewOf(buffer));
 
 #if USE_EDGE_DETECTION
     // edge detection
@@ -249,20 +529,22 @@ int main(int argc, char** argv) {
     image.copyTo(result, edges);
 #endif
 
-    int gen_ctr = 0;
-
     if (headless) {
-        while (gen_ctr < gen_limit) {
-            NextGeneration(w, h, buffer, image.data);
-            gen_ctr++;
-        }
+        const EvolveResult result = engine.Run(gen_limit, budget_ms);
         u64 start = file_path.find_last_of('/');
         std::string out_file = "out_" + file_path.substr(start == std::string::npos ? 0 : start);
-        printf("Finished after %d generations, saving to %s\n", gen_ctr, out_file.c_str());
+        printf("Finished after %u generations and %llu mutations%s, saving to %s\n", result.generations,
+               (unsigned long long)result.mutations, result.expired ? " (out of time)" : "", out_file.c_str());
+        engine.PrintStats();
+        if (Perf().Enabled()) Perf().Print(Metrics().generations.Value());
+        TRACE_SCOPE("imwrite");
         cv::imwrite(out_file, buffer);
         return 0;
     }
 
+#if IMAGE_EVO_SDL
+    const int w = image.cols, h = image.rows;
+    int gen_ctr = 0;
     std::string window_name = "ImageEvo [" + file_path + "]";
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         printf("Error: %s\n", SDL_GetError());
@@ -288,8 +570,28 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // the evolution runs on its own thread and publishes snapshots, the vsync only throttles this thread
+    SDL_UpdateTexture(texture, nullptr, buffer.data, buffer.step);
+    TripleBuffer<CanvasSnapshot> snapshots;
+    SnapshotPublisher publisher(snapshots, buffer);
+    std::atomic<bool> done{false}, pause{false};
+    std::thread evolution([&]() {
+        TRACE_THREAD("evolution");
+        omp_set_num_threads(threads);
+        while (!done) {
+            if (pause || gen_ctr >= gen_limit) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            engine.Step();
+            printf("Generation #%d\n", gen_ctr);
+            gen_ctr++;
+            publisher.Publish(buffer, engine.TakeDirty(), gen_ctr);
+        }
+    });
+
     printf("Press H to pause and S to save to file\n");
-    bool done = false, pause = false, take_screenshot = false;
+    bool take_screenshot = false;
     while (!done) {
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
@@ -301,25 +603,38 @@ int main(int argc, char** argv) {
             if (event.type == SDL_KEYUP && event.key.keysym.scancode == SDL_SCANCODE_S) take_screenshot = true;
         }
 
-        if (take_screenshot) {
-            take_screenshot = false;
-            printf("Saved screenshot\n");
-            cv::imwrite("screenshot.png", buffer);
+        // upload only what changed since the snapshot shown before
+        if (snapshots.Update()) {
+            TRACE_SCOPE("upload");
+            const CanvasSnapshot& snapshot = snapshots.Front();
+            const BoundingBox& box = snapshot.dirty;
+            if (!box.Empty()) {
+                const SDL_Rect rect = {box.start_x, box.start_y, box.end_x - box.start_x, box.end_y - box.start_y};
+                SDL_UpdateTexture(texture, &rect, snapshot.canvas.ptr(box.start_y) + box.start_x * 3,
+                                  snapshot.canvas.step);
+            }
         }
 
-        if (!pause && gen_ctr < gen_limit) {
-            NextGeneration(w, h, buffer, image.data);
-            printf("Generation #%d\n", gen_ctr);
-            gen_ctr++;
+        if (take_screenshot) {
+            take_screenshot = false;
+            printf("Saved screenshot of generation %d\n", snapshots.Front().generation);
+            cv::imwrite("screenshot.png", snapshots.Front().canvas);
         }
 
-        Render(renderer, texture, buffer);
+        Render(renderer, texture);
     }
+    evolution.join();
 
+    engine.PrintStats();
+    if (Perf().Enabled()) Perf().Print(Metrics().generations.Value());
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     return 0;
+#else
+    printf("This build has no SDL preview, only headless mode is available\n");
+    return 1;
+#endif
 }
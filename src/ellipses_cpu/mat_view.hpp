@@ -0,0 +1,11 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include "image.hpp"
+
+// Views of CV_8UC3 matrices for the engine, the pixels stay where they are
+
+inline ImageView ViewOf(cv::Mat& mat) { return ImageView(mat.data, mat.cols, mat.rows, mat.step); }
+
+inline ConstImageView ViewOf(const cv::Mat& mat) { return ConstImageView(mat.data, mat.cols, mat.rows, mat.step); }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry.hpp"
+
+// Always on runtime metrics. Updates are relaxed atomics on slots spread over cache lines by thread, so the workers
+// of a batch do not contend on a shared line, reads sum up all slots.
+
+class Counter;
+class Histogram;
+
+// Every counter and histogram registers itself here on construction, dumps walk the registry
+class MetricsRegistry {
+public:
+    static MetricsRegistry& Get() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    std::vector<const Counter*> counters;
+    std::vector<const Histogram*> histograms;
+};
+
+// index of the slot the calling thread updates
+inline u32 MetricsSlot() {
+    static std::atomic<u32> next{0};
+    thread_local const u32 slot = next++;
+    return slot;
+}
+
+class Counter {
+public:
+    static constexpr u32 slot_count = 16;
+
+    Counter(const char* name, const char* help) : name(name), help(help) {
+        MetricsRegistry::Get().counters.push_back(this);
+    }
+
+    void Add(u64 n) { slots[MetricsSlot() % slot_count].value.fetch_add(n, std::memory_order_relaxed); }
+
+    u64 Value() const {
+        u64 sum = 0;
+        for (const Slot& slot : slots) sum += slot.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    const char* name;
+    const char* help;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<u64> value{0};
+    };
+    Slot slots[slot_count];
+};
+
+// HDR style histogram of nanosecond latencies. Values below 2^(sub_bits + 1) are exact, above that every power of two
+// is split into 2^sub_bits buckets, which keeps the relative error of every percentile below 2^-sub_bits at any
+// magnitude. Recording is a handful of instructions and one relaxed add.
+class Histogram {
+public:
+    static constexpr u32 sub_bits = 6, sub_count = 1 << sub_bits;
+    static constexpr u32 bucket_count = (64 - sub_bits + 1) * sub_count;
+
+    Histogram(const char* name, const char* help) : name(name), help(help), buckets(bucket_count) {
+        MetricsRegistry::Get().histograms.push_back(this);
+    }
+
+    static u32 Bucket(u64 value) {
+        if (value < 2 * sub_count) return value;
+        const u32 magnitude = 63 - __builtin_clzll(value);
+        return (magnitude - sub_bits + 1) * sub_count + u32(value >> (magnitude - sub_bits)) - sub_count;
+    }
+
+    // smallest value falling into bucket
+    static u64 BucketStart(u32 bucket) {
+        if (bucket < 2 * sub_count) return bucket;
+        const u32 magnitude = bucket / sub_count + sub_bits - 1;
+        return u64(bucket % sub_count + sub_count) << (magnitude - sub_bits);
+    }
+
+    void Record(u64 ns) {
+        buckets[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        u64 current = max.load(std::memory_order_relaxed);
+        while (ns > current && !max.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    u64 Count() const { return count.load(std::memory_order_relaxed); }
+    u64 Sum() const { return sum.load(std::memory_order_relaxed); }
+    u64 Max() const { return max.load(std::memory_order_relaxed); }
+
+    // value at quantile q in [0, 1], the middle of its bucket
+    u64 Quantile(double q) const {
+        const u64 total = Count();
+        if (total == 0) return 0;
+        const u64 rank = std::max<u64>(1, u64(q * total + 0.5));
+        u64 seen = 0;
+        for (u32 bucket = 0; bucket < bucket_count; ++bucket) {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                const u64 start = BucketStart(bucket), end = BucketStart(bucket + 1);
+                return std::min(Max(), start + (end - start) / 2);
+            }
+        }
+        return Max();
+    }
+
+    const char* name;
+    const char* help;
+
+private:
+    std::vector<std::atomic<u64>> buckets;
+    std::atomic<u64> count{0}, sum{0}, max{0};
+};
+
+// Measures the lifetime of the scope into a histogram
+class ScopedLatency {
+public:
+    explicit ScopedLatency(Histogram& histogram)
+        : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedLatency() {
+        histogram.Record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    Histogram& histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Metrics of the evolution engine, shared by every engine of the process
+struct EngineMetrics {
+    Counter mutations{"imageevo_mutations_total", "Candidates evaluated, including random restarts"};
+    Counter pixels_evaluated{"imageevo_pixels_evaluated_total", "Pixels covered by evaluated candidates"};
+    Counter pixels_drawn{"imageevo_pixels_drawn_total", "Pixels painted onto the canvas"};
+    Counter accepts{"imageevo_accepts_total", "Candidates that improved the canvas and got drawn"};
+    Counter restarts{"imageevo_restarts_total", "Random candidates evaluated before the first hit of a generation"};
+    Counter bytes_copied{"imageevo_bytes_copied_total", "Canvas bytes backed up and restored"};
+    Counter generations{"imageevo_generations_total", "Completed generations"};
+    Counter frames{"imageevo_frames_total", "Evolved video frames"};
+    Histogram generation_latency{"imageevo_generation_seconds", "Wall time of a generation"};
+    Histogram frame_latency{"imageevo_frame_seconds", "Wall time of the evolution of a video frame"};
+};
+
+inline EngineMetrics& Metrics() {
+    static EngineMetrics metrics;
+    return metrics;
+}
+
+// quantiles every dump reports
+const double metric_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// Writes through a temporary file and a rename, so a scraper never reads half a dump
+inline bool WriteMetricsFile(const std::string& path, const std::string& text) {
+    const std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "w");
+    if (!file) return false;
+    const bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    if (fclose(file) != 0 || !written) return false;
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+inline std::string MetricsJson() {
+    const MetricsRegistry& registry = MetricsRegistry::Get();
+    char line[512];
+    std::string json = "{\n  \"counters\": {";
+    for (u64 i = 0; i < registry.counters.size(); ++i) {
+        const Counter& counter = *registry.counters[i];
+        snprintf(line, sizeof(line), "%s\n    \"%s\": %llu", i ? "," : "", counter.name,
+                 (unsigned long long)counter.Value());
+        json += line;
+    }
+    json += "\n  },\n  \"histograms\": {";
+    for (u64 i = 0; i < registry.histograms.size(); ++i) {
+        const Histogram& histogram = *registry.histograms[i];
+        snprintf(line, sizeof(line), "%s\n    \"%s\": {\"count\": %llu, \"sum_ns\": %llu, \"max_ns\": %llu",
+                 i ? "," : "", histogram.name, (unsigned long long)histogram.Count(),
+                 (unsigned long long)histogram.Sum(), (unsigned long long)histogram.Max());
+        json += line;
+        for (double q : metric_quantiles) {
+            snprintf(line, sizeof(line), ", \"p%g_ns\": %llu", q * 100, (unsigned long long)histogram.Quantile(q));
+            json += line;
+        }
+        json += "}";
+    }
+    json += "\n  }\n}\n";
+    return json;
+}
+
+// Prometheus text exposition format, histograms are exposed as summaries with their quantiles in seconds
+inline std::string MetricsPrometheus() {
+    const MetricsRegistry& registry = MetricsRegistry::Get();
+    char line[512];
+    std::string text;
+    for (const Counter* counter : registry.counters) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter->name, counter->help,
+                 counter->name, counter->name, (unsigned long long)counter->Value());
+        text += line;
+    }
+    for (const Histogram* histogram : registry.histograms) {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s summary\n", histogram->name, histogram->help,
+                 histogram->name);
+        text += line;
+        for (double q : metric_quantiles) {
+            snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.9f\n", histogram->name, q,
+                     histogram->Quantile(q) * 1e-9);
+            text += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", histogram->name, histogram->Sum() * 1e-9,
+                 histogram->name, (unsigned long long)histogram->Count());
+        text += line;
+    }
+    return text;
+}
+
+// Rewrites the Prometheus dump every interval on a background thread, and a last time when it gets destroyed
+class MetricsReporter {
+public:
+    MetricsReporter(std::string path, double interval_seconds) : path(std::move(path)) {
+        Metrics();
+        thread = std::thread([this, interval_seconds]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stop) {
+                wake.wait_for(lock, std::chrono::duration<double>(interval_seconds), [this]() { return stop; });
+                if (!WriteMetricsFile(this->path, MetricsPrometheus())) {
+                    printf("Failed to write metrics to %s\n", this->path.c_str());
+                }
+            }
+        });
+    }
+
+    ~MetricsReporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+private:
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+    std::thread thread;
+};
+
+// Writes the JSON dump when it goes out of scope, which covers every exit path of the owner
+class MetricsJsonDump {
+public:
+    // the engine metrics get registered up front, so the dump lists them even if nothing ran
+    explicit MetricsJsonDump(std::string path) : path(std::move(path)) { Metrics(); }
+
+    ~MetricsJsonDump() {
+        if (!path.empty() && !WriteMetricsFile(path, MetricsJson())) {
+            printf("Failed to write metrics to %s\n", path.c_str());
+        }
+    }
+
+private:
+    std::string path;
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "geometry.hpp"
+
+// Optional hardware counters around the fitness and draw kernels, from perf_event_open on Linux. Every thread opens
+// its own counter group on its first sample, a sample reads the group before and after the kernel. User space only,
+// which works down to perf_event_paranoid 2. Without counters, e.g. in containers or on other platforms, sampling
+// turns into a no-op after one message.
+
+enum PerfEvent { Cycles, Instructions, L1Misses, LlcMisses, BranchMisses, perf_event_count };
+
+const char* const perf_event_names[] = {"cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+
+// Counter group of the calling thread
+class PerfGroup {
+public:
+    PerfGroup() {
+#ifdef __linux__
+        const u64 configs[perf_event_count][2] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+        for (int event = 0; event < perf_event_count; ++event) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = configs[event][0];
+            attr.config = configs[event][1];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // this thread on any cpu
+            const int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd < 0) {
+                // without the leader there is no group, a missing member only leaves a gap
+                if (leader < 0) {
+                    error = errno;
+                    return;
+                }
+                continue;
+            }
+            if (leader < 0) leader = fd;
+            fds[event] = fd;
+            slots[event] = open_count++;
+        }
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    ~PerfGroup() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    bool IsOpen() const { return leader >= 0; }
+
+    // current counts, events that could not be opened stay 0
+    void Read(u64 (&values)[perf_event_count]) const {
+        std::memset(values, 0, sizeof(values));
+#ifdef __linux__
+        u64 buffer[1 + perf_event_count];
+        if (read(leader, buffer, sizeof(buffer)) < ssize_t(sizeof(u64))) return;
+        for (int event = 0; event < perf_event_count; ++event) {
+            if (slots[event] >= 0 && slots[event] < i64(buffer[0])) values[event] = buffer[1 + slots[event]];
+        }
+#endif
+    }
+
+    // index of every event in the group read, -1 if it is not counted
+    int slots[perf_event_count] = {-1, -1, -1, -1, -1};
+    int error = 0;
+
+private:
+    int leader = -1;
+    int fds[perf_event_count] = {-1, -1, -1, -1, -1};
+    int open_count = 0;
+};
+
+// Counts of one kernel summed over all threads
+struct PerfPhase {
+    const char* name;
+    std::atomic<u64> counts[perf_event_count] = {};
+    std::atomic<u64> samples{0}, pixels{0};
+};
+
+class PerfCounters {
+public:
+    PerfPhase fitness{"fitness"}, draw{"draw"};
+
+    // The kernels run on the calling thread while enabled, so the counts of one call stay on one counter group.
+    // Returns false and stays disabled if the counters are unavailable.
+    bool Enable() {
+        if (!Group()) return false;
+        enabled.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool Enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // group of the calling thread, nullptr if the counters are unavailable
+    const PerfGroup* Group() {
+        thread_local PerfGroup group;
+        if (!group.IsOpen()) {
+            if (!warned.exchange(true)) {
+                printf("Hardware counters unavailable (%s), check kernel.perf_event_paranoid\n",
+                       group.error ? strerror(group.error) : "not supported on this platform");
+            }
+            return nullptr;
+        }
+        return &group;
+    }
+
+    // counts per pixel of each kernel and per generation of both
+    void Print(u64 generations) const {
+        printf("%-14s %14s %14s %14s\n", "counter", "fitness/pixel", "draw/pixel", "per generation");
+        for (int event = 0; event < perf_event_count; ++event) {
+            const u64 f = fitness.counts[event], d = draw.counts[event];
+            printf("%-14s %14.3f %14.3f %14.0f\n", perf_event_names[event], PerPixel(fitness, f), PerPixel(draw, d),
+                   generations ? double(f + d) / generations : 0.0);
+        }
+        const u64 cycles = fitness.counts[Cycles] + draw.counts[Cycles];
+        const u64 instructions = fitness.counts[Instructions] + draw.counts[Instructions];
+        printf("IPC %.2f over %llu fitness and %llu draw samples\n", cycles ? double(instructions) / cycles : 0.0,
+               (unsigned long long)fitness.samples.load(), (unsigned long long)draw.samples.load());
+    }
+
+private:
+    static double PerPixel(const PerfPhase& phase, u64 count) {
+        return phase.pixels ? double(count) / phase.pixels : 0.0;
+    }
+
+    std::atomic<bool> enabled{false}, warned{false};
+};
+
+inline PerfCounters& Perf() {
+    static PerfCounters counters;
+    return counters;
+}
+
+// Adds the counts of its lifetime on the calling thread to phase, does nothing unless the counters are enabled
+class PerfScope {
+public:
+    explicit PerfScope(PerfPhase& phase) {
+        PerfCounters& perf = Perf();
+        if (!perf.Enabled()) return;
+        group = perf.Group();
+        if (!group) return;
+        this->phase = &phase;
+        group->Read(start);
+    }
+
+    ~PerfScope() {
+        if (!group) return;
+        u64 end[perf_event_count];
+        group->Read(end);
+        for (int event = 0; event < perf_event_count; ++event) {
+            phase->counts[event].fetch_add(end[event] - start[event], std::memory_order_relaxed);
+        }
+        phase->samples.fetch_add(1, std::memory_order_relaxed);
+        phase->pixels.fetch_add(pixels, std::memory_order_relaxed);
+    }
+
+    // pixels the sample covered
+    u64 pixels = 0;
+
+private:
+    const PerfGroup* group = nullptr;
+    PerfPhase* phase = nullptr;
+    u64 start[perf_event_count];
+};
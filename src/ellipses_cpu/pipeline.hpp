@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry.hpp"
+#include "trace.hpp"
+
+// Bounded lock-free single producer single consumer queue. A full queue blocks the producer and an empty one the
+// consumer, which gives the pipeline stages backpressure. Waiting spins briefly and then sleeps, so a stalled stage
+// does not take cpu time away from the evolution.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(u32 capacity) : slots(capacity + 1) {}
+
+    bool TryPush(T& value) {
+        const u32 tail = write.load(std::memory_order_relaxed);
+        const u32 next = (tail + 1) % slots.size();
+        if (next == read.load(std::memory_order_acquire)) return false;
+        slots[tail] = std::move(value);
+        write.store(next, std::memory_order_release);
+        depth_sum += Size();
+        pushes++;
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        const u32 head = read.load(std::memory_order_relaxed);
+        if (head == write.load(std::memory_order_acquire)) return false;
+        value = std::move(slots[head]);
+        read.store((head + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    void Push(T value) {
+        for (u32 spins = 0; !TryPush(value); ++spins) Wait(spins);
+    }
+
+    T Pop() {
+        T value;
+        for (u32 spins = 0; !TryPop(value); ++spins) Wait(spins);
+        return value;
+    }
+
+    u32 Size() const {
+        const u32 size = slots.size();
+        return (write.load(std::memory_order_acquire) + size - read.load(std::memory_order_acquire)) % size;
+    }
+
+    u32 Capacity() const { return slots.size() - 1; }
+
+    // average number of queued items right after a push, only valid once the producer is done
+    double AverageDepth() const { return pushes ? double(depth_sum) / pushes : 0.0; }
+
+private:
+    static void Wait(u32 spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    std::vector<T> slots;
+    alignas(64) std::atomic<u32> read{0};
+    alignas(64) std::atomic<u32> write{0};
+    // producer side statistics
+    alignas(64) u64 depth_sum = 0;
+    u64 pushes = 0;
+};
+
+// Time a pipeline stage spent working compared to the time it was running
+struct StageStats {
+    const char* name;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double busy = 0.0, total = 0.0;
+
+    // measures the work done by f
+    template <typename F>
+    void Run(F&& f) {
+        const auto begin = std::chrono::steady_clock::now();
+        f();
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void Finish() { total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+    double Occupancy() const { return total > 0 ? busy / total : 0.0; }
+};
+
+// Thread pool with a task deque per worker. Tasks are handed out round robin, a worker takes its own tasks and, once it
+// runs dry, steals from the other deques, which balances tasks of uneven cost. Owner and thieves both take the oldest
+// task, so frames get evolved in about the order the ordered sink writes them.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(u32 worker)>;
+
+    explicit WorkStealingPool(u32 workers) : queues(workers) {
+        for (u32 i = 0; i < workers; ++i) queues[i] = std::make_unique<TaskQueue>();
+        for (u32 i = 0; i < workers; ++i) {
+            threads.emplace_back([this, i]() {
+                TRACE_THREAD("engine " + std::to_string(i));
+                Work(i);
+            });
+        }
+    }
+
+    // finishes all submitted tasks before returning
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    void Submit(Task task) {
+        TaskQueue& queue = *queues[next++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    u32 Workers() const { return queues.size(); }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool TryTake(u32 worker, Task& task) {
+        for (u32 i = 0; i < queues.size(); ++i) {
+            TaskQueue& queue = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void Work(u32 worker) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this]() { return pending > 0 || stop; });
+                if (pending == 0) return;
+                pending--;
+            }
+            // a pending task is guaranteed to be in one of the deques
+            Task task;
+            while (!TryTake(worker, task)) std::this_thread::yield();
+            task(worker);
+        }
+    }
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<u32> next{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    u32 pending = 0;
+    bool stop = false;
+};
+
+// Counting semaphore bounding the number of frames in flight
+class Semaphore {
+public:
+    explicit Semaphore(u32 count) : count(count) {}
+
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]() { return count > 0; });
+        count--;
+    }
+
+    void Release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count++;
+        }
+        available.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    u32 count;
+};
+
+// Lock-free triple buffer between one producer and one consumer. The producer fills Back() and publishes it, the
+// consumer takes the latest published buffer with Update(). Neither side ever waits, the producer overwrites a
+// published buffer the consumer did not take yet.
+template <typename T>
+class TripleBuffer {
+public:
+    T& Back() { return buffers[back]; }
+    u32 BackIndex() const { return back; }
+
+    // publishes Back(), returns false if the previously published buffer got dropped without being taken
+    bool Publish() {
+        const u8 old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+        back = old & index_mask;
+        return !(old & fresh);
+    }
+
+    // makes the latest published buffer the front buffer, returns false if nothing new got published
+    bool Update() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    T& Front() { return buffers[front]; }
+
+    T& operator[](u32 index) { return buffers[index]; }
+
+private:
+    static constexpr u8 fresh = 4, index_mask = 3;
+    T buffers[3];
+    u32 front = 0, back = 1;
+    std::atomic<u8> middle{2};
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "image.hpp"
+#include "raster.hpp"
+
+// Per-row prefix sums of the original, the squared original and the squared error of the canvas. Entry x of a row
+// holds the sum over the pixels [0, x) for each channel, so any span can be summed up in O(1). Under a squared error
+// metric this yields the error of painting an ellipse with a constant color as well as its optimal (mean) color in
+// O(rows) instead of O(area).
+struct RowPrefixSums {
+    int width = 0, height = 0;
+    std::vector<u32> original, original_sq, error_sq;
+
+    u32 Index(int x, int y) const { return (y * (width + 1) + x) * 3; }
+
+    void Init(ConstImageView original_image, const u8* error) {
+        width = original_image.width;
+        height = original_image.height;
+        const u32 size = height * (width + 1) * 3;
+        original.resize(size);
+        original_sq.resize(size);
+        error_sq.resize(size);
+        #pragma omp parallel for
+        for (int y = 0; y < height; ++y) {
+            u32 sum[3] = {}, sum_sq[3] = {};
+            const u8* original_row = original_image.Row(y);
+            for (int x = 0; x < width; ++x) {
+                const u32 index = Index(x, y);
+                for (int ch = 0; ch < 3; ++ch) {
+                    original[index + ch] = sum[ch];
+                    original_sq[index + ch] = sum_sq[ch];
+                    const u32 value = original_row[x * 3 + ch];
+                    sum[ch] += value;
+                    sum_sq[ch] += value * value;
+                }
+            }
+            for (int ch = 0; ch < 3; ++ch) {
+                original[Index(width, y) + ch] = sum[ch];
+                original_sq[Index(width, y) + ch] = sum_sq[ch];
+            }
+            UpdateErrorRow(y, error);
+        }
+    }
+
+    // must be called for every row in which the error map changed
+    void UpdateErrorRow(int y, const u8* error) {
+        u32 sum[3] = {};
+        u32* row = error_sq.data() + Index(0, y);
+        const u8* error_row = error + y * width * 3;
+        for (int x = 0; x < width; ++x) {
+            for (int ch = 0; ch < 3; ++ch) {
+                row[x * 3 + ch] = sum[ch];
+                sum[ch] += u32(error_row[x * 3 + ch]) * error_row[x * 3 + ch];
+            }
+        }
+        for (int ch = 0; ch < 3; ++ch) row[width * 3 + ch] = sum[ch];
+    }
+};
+
+// Accumulated prefix sums over all spans of a shape
+struct ShapeSums {
+    i64 pixels = 0;
+    i64 original[3] = {}, original_sq[3] = {}, error_sq[3] = {};
+
+    ShapeSums(const RowPrefixSums& sums, const EllipseRaster& raster) {
+        for (int y = raster.box.start_y; y < raster.box.end_y; ++y) {
+            int x0, x1;
+            if (!raster.Span(y, x0, x1)) continue;
+            const u32 start = sums.Index(x0, y), end = sums.Index(x1, y);
+            pixels += x1 - x0;
+            for (int ch = 0; ch < 3; ++ch) {
+                original[ch] += sums.original[end + ch] - sums.original[start + ch];
+                original_sq[ch] += sums.original_sq[end + ch] - sums.original_sq[start + ch];
+                error_sq[ch] += sums.error_sq[end + ch] - sums.error_sq[start + ch];
+            }
+        }
+    }
+
+    // mean of the original inside of the shape, which minimizes the squared error of a constant fill
+    Color MeanColor() const {
+        if (pixels == 0) return Color();
+        return {u8((original[0] + pixels / 2) / pixels), u8((original[1] + pixels / 2) / pixels),
+                u8((original[2] + pixels / 2) / pixels)};
+    }
+
+    // change of the squared error if the shape gets painted with color
+    i64 Delta(const Color& color) const {
+        const i64 c[3] = {color.r, color.g, color.b};
+        i64 delta = 0;
+        for (int ch = 0; ch < 3; ++ch) {
+            delta += original_sq[ch] - 2 * c[ch] * original[ch] + pixels * c[ch] * c[ch] - error_sq[ch];
+        }
+        return delta;
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "image.hpp"
+#include "raster.hpp"
+
+struct PyramidLevel {
+    int width = 0, height = 0;
+    std::vector<u8> data;
+};
+
+// Mip pyramid of a BGR24 image, every level averages 2x2 pixels of the level below. levels[0] is the image at half
+// resolution, trailing rows and columns that don't fill a 2x2 block are dropped.
+struct Pyramid {
+    std::vector<PyramidLevel> levels;
+
+    void Init(ConstImageView image, int count) {
+        levels.resize(count);
+        for (int l = 0; l < count; ++l) {
+            levels[l].width = image.width >> (l + 1);
+            levels[l].height = image.height >> (l + 1);
+            levels[l].data.resize(levels[l].width * levels[l].height * 3);
+        }
+        Update(image, {0, image.width, 0, image.height});
+    }
+
+    const PyramidLevel& Top() const { return levels.back(); }
+
+    // rebuilds all pixels depending on the given region of the full resolution image
+    void Update(ConstImageView image, BoundingBox box) {
+        ConstImageView src = image;
+        for (PyramidLevel& level : levels) {
+            box = {box.start_x / 2, std::min(level.width, (box.end_x + 1) / 2), box.start_y / 2,
+                   std::min(level.height, (box.end_y + 1) / 2)};
+            for (int y = box.start_y; y < box.end_y; ++y) {
+                const u8* row0 = src.Row(y * 2);
+                const u8* row1 = src.Row(y * 2 + 1);
+                for (int x = box.start_x; x < box.end_x; ++x) {
+                    for (int ch = 0; ch < 3; ++ch) {
+                        const u32 i = x * 6 + ch;
+                        level.data[(x + y * level.width) * 3 + ch] =
+                            (row0[i] + row0[i + 3] + row1[i] + row1[i + 3] + 2) / 4;
+                    }
+                }
+            }
+            src = ConstImageView(level.data.data(), level.width, level.height, u64(level.width) * 3);
+        }
+    }
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "ellipse_form.hpp"
+#include "geometry.hpp"
+
+// Clipped bounding box, the end coordinates are exclusive
+struct BoundingBox {
+    int start_x, end_x, start_y, end_y;
+
+    bool Empty() const { return start_x >= end_x || start_y >= end_y; }
+};
+
+// Smallest box containing both boxes
+inline BoundingBox Union(const BoundingBox& a, const BoundingBox& b) {
+    if (a.Empty()) return b;
+    if (b.Empty()) return a;
+    return {std::min(a.start_x, b.start_x), std::max(a.end_x, b.end_x), std::min(a.start_y, b.start_y),
+            std::max(a.end_y, b.end_y)};
+}
+
+inline BoundingBox GetBoundingBox(int width, int height, const Ellipse& e) {
+    const int bb = std::max(e.major, e.minor);
+    return {std::max(0, int(e.origin.x) - bb), std::min(width, int(e.origin.x) + bb),
+            std::max(0, int(e.origin.y) - bb), std::min(height, int(e.origin.y) + bb)};
+}
+
+// Scanline rasterizer for rotated ellipses. For a fixed row the quadratic form of the ellipse is a parabola in xc,
+// so every row is covered by a single span. The real roots of the parabola only serve as starting points, the exact
+// span ends are found by stepping the integer form with forward differences
+//   Q(x + 1) - Q(x) = a * (2x + 1) + b * yc
+// which keeps the coverage identical to EllipseForm::Contains.
+struct EllipseRaster {
+    BoundingBox box;
+    int origin_x, origin_y;
+    EllipseForm form;
+
+    EllipseRaster(int width, int height, const Ellipse& e)
+        : box(GetBoundingBox(width, height, e)),
+          origin_x(e.origin.x),
+          origin_y(e.origin.y),
+          form(EllipseForm::Create(e.major, e.minor, e.angle)) {
+        // degenerate ellipses cover no pixels
+        if (form.a <= 0) box.end_y = box.start_y;
+    }
+
+    // covered pixels [x0, x1) of row y, returns false if the row is empty
+    bool Span(int y, int& x0, int& x1) const {
+        const i64 yc = y - origin_y;
+        const i64 lo = box.start_x - origin_x, hi = box.end_x - origin_x - 1;
+        if (lo > hi) return false;
+        const i64 a = form.a, by = form.b * yc, f = form.f;
+
+        // minimum of the row inside of the box, the real vertex is exact up to rounding
+        const double vertex = -double(by) / (2.0 * a);
+        i64 m = std::clamp<i64>(i64(std::floor(vertex)), lo, hi);
+        i64 qm = form.Eval(m, yc);
+        while (m > lo && form.Eval(m - 1, yc) < qm) qm = form.Eval(--m, yc);
+        while (m < hi && form.Eval(m + 1, yc) < qm) qm = form.Eval(++m, yc);
+        if (qm > f) return false;
+
+        const double disc = double(by) * by - 4.0 * a * (double(form.c) * yc * yc - f);
+        const double root = disc > 0 ? std::sqrt(disc) / (2.0 * a) : 0.0;
+
+        // left end, step outwards while covered or inwards while not
+        i64 x = std::clamp<i64>(i64(std::ceil(vertex - root)), lo, m);
+        i64 q = form.Eval(x, yc);
+        if (q <= f) {
+            for (i64 qp; x > lo && (qp = q - (a * (2 * x - 1) + by)) <= f; --x) q = qp;
+        } else {
+            for (; q > f; ++x) q += a * (2 * x + 1) + by;
+        }
+        x0 = origin_x + x;
+
+        // right end
+        x = std::clamp<i64>(i64(std::floor(vertex + root)), m, hi);
+        q = form.Eval(x, yc);
+        if (q <= f) {
+            for (i64 qn; x < hi && (qn = q + a * (2 * x + 1) + by) <= f; ++x) q = qn;
+        } else {
+            for (; q > f; --x) q -= a * (2 * x - 1) + by;
+        }
+        x1 = origin_x + x + 1;
+        return true;
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdlib>
+
+#include "geometry.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGEEVO_X86 1
+#else
+#define IMAGEEVO_X86 0
+#endif
+
+// Fitness kernels for a contiguous span of BGR24 pixels. They return
+//   sum(|original - color|) - sum(error)
+// over all channels, i.e. the change of the error map if the span got painted with color.
+// All variants work on integers only and return bit-identical results.
+using SpanDeltaFn = i64 (*)(const u8* original, const u8* error, u32 pixels, Color color);
+
+inline i64 SpanDeltaScalar(const u8* original, const u8* error, u32 pixels, Color color) {
+    i64 delta = 0;
+    for (u32 index = 0; index < pixels * 3; index += 3) {
+        delta += std::abs(int(original[index]) - int(color.r)) - int(error[index]);
+        delta += std::abs(int(original[index + 1]) - int(color.g)) - int(error[index + 1]);
+        delta += std::abs(int(original[index + 2]) - int(color.b)) - int(error[index + 2]);
+    }
+    return delta;
+}
+
+#if IMAGEEVO_X86
+// The color repeats every 3 bytes, a block of 3 vectors starts and ends on a pixel boundary so the same
+// 3 color vectors can be reused for every block.
+template <u32 N>
+inline void FillColorPattern(u8 (&pattern)[N], Color color) {
+    for (u32 i = 0; i < N; i += 3) {
+        pattern[i] = color.r;
+        pattern[i + 1] = color.g;
+        pattern[i + 2] = color.b;
+    }
+}
+
+inline i64 SpanDeltaSSE2(const u8* original, const u8* error, u32 pixels, Color color) {
+    alignas(16) u8 pattern[48];
+    FillColorPattern(pattern, color);
+    const __m128i c0 = _mm_load_si128((const __m128i*)pattern);
+    const __m128i c1 = _mm_load_si128((const __m128i*)(pattern + 16));
+    const __m128i c2 = _mm_load_si128((const __m128i*)(pattern + 32));
+    const __m128i zero = _mm_setzero_si128();
+
+    // psadbw sums 8 absolute differences into each 64-bit lane
+    __m128i acc = _mm_setzero_si128();
+    const u32 blocks = pixels / 16;
+    for (u32 i = 0; i < blocks; ++i, original += 48, error += 48) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)original), c0));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(original + 16)), c1));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(original + 32)), c2));
+        acc = _mm_sub_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)error), zero));
+        acc = _mm_sub_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(error + 16)), zero));
+        acc = _mm_sub_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(error + 32)), zero));
+    }
+    alignas(16) i64 lanes[2];
+    _mm_store_si128((__m128i*)lanes, acc);
+    return lanes[0] + lanes[1] + SpanDeltaScalar(original, error, pixels - blocks * 16, color);
+}
+
+__attribute__((target("avx2"))) inline i64 SpanDeltaAVX2(const u8* original, const u8* error, u32 pixels,
+                                                         Color color) {
+    alignas(32) u8 pattern[96];
+    FillColorPattern(pattern, color);
+    const __m256i c0 = _mm256_load_si256((const __m256i*)pattern);
+    const __m256i c1 = _mm256_load_si256((const __m256i*)(pattern + 32));
+    const __m256i c2 = _mm256_load_si256((const __m256i*)(pattern + 64));
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i acc = _mm256_setzero_si256();
+    const u32 blocks = pixels / 32;
+    for (u32 i = 0; i < blocks; ++i, original += 96, error += 96) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)original), c0));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(original + 32)), c1));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(original + 64)), c2));
+        acc = _mm256_sub_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)error), zero));
+        acc = _mm256_sub_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(error + 32)), zero));
+        acc = _mm256_sub_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(error + 64)), zero));
+    }
+    alignas(32) i64 lanes[4];
+    _mm256_store_si256((__m256i*)lanes, acc);
+    // the remaining pixels are handled by the narrower kernel
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SpanDeltaSSE2(original, error, pixels - blocks * 32, color);
+}
+#endif
+
+// picks the widest kernel supported by the executing cpu
+inline SpanDeltaFn SelectSpanDelta() {
+#if IMAGEEVO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SpanDeltaAVX2;
+    return SpanDeltaSSE2;
+#else
+    return SpanDeltaScalar;
+#endif
+}
+
+inline const char* SpanDeltaName(SpanDeltaFn fn) {
+#if IMAGEEVO_X86
+    if (fn == SpanDeltaAVX2) return "avx2";
+    if (fn == SpanDeltaSSE2) return "sse2";
+#endif
+    return "scalar";
+}
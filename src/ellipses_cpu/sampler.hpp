@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "raster.hpp"
+
+// Samples pixels proportionally to the error of the tile they belong to. The tile errors are kept in a Fenwick
+// tree, so both updating a tile and drawing a sample take O(log tiles).
+struct ErrorSampler {
+    static constexpr int tile_size = 16;
+    int width = 0, height = 0, tiles_x = 0, tiles_y = 0;
+    std::vector<i64> tile_error;
+    // if not empty only tiles marked here get sampled
+    std::vector<u8> active;
+    // tree[i] holds the sum of the tile weights (i - lowbit(i), i]
+    std::vector<i64> tree;
+    int top_bit = 0;
+
+    void Init(int w, int h, const u8* error) {
+        width = w;
+        height = h;
+        tiles_x = (w + tile_size - 1) / tile_size;
+        tiles_y = (h + tile_size - 1) / tile_size;
+        tile_error.assign(tiles_x * tiles_y, 0);
+        active.clear();
+        tree.assign(tile_error.size() + 1, 0);
+        top_bit = 1;
+        while (top_bit * 2 <= int(tile_error.size())) top_bit *= 2;
+        Update(error, {0, w, 0, h});
+    }
+
+    i64 Total() const {
+        i64 total = 0;
+        for (int i = tile_error.size(); i > 0; i -= i & -i) total += tree[i];
+        return total;
+    }
+
+    // recomputes all tiles overlapping the given region of the error map
+    void Update(const u8* error, const BoundingBox& box) {
+        for (int ty = box.start_y / tile_size; ty < (box.end_y + tile_size - 1) / tile_size; ++ty) {
+            for (int tx = box.start_x / tile_size; tx < (box.end_x + tile_size - 1) / tile_size; ++tx) {
+                const int end_x = std::min(width, (tx + 1) * tile_size);
+                i64 sum = 0;
+                for (int y = ty * tile_size; y < std::min(height, (ty + 1) * tile_size); ++y) {
+                    for (u32 i = (tx * tile_size + y * width) * 3; i < u32(end_x + y * width) * 3; ++i) sum += error[i];
+                }
+                const int tile = tx + ty * tiles_x;
+                const i64 weight = Weight(tile);
+                tile_error[tile] = sum;
+                Add(tile, Weight(tile) - weight);
+            }
+        }
+    }
+
+    // restricts the sampling to the marked tiles, an empty mask enables all of them
+    void SetActive(const std::vector<u8>& mask) {
+        active.assign(mask.begin(), mask.end());
+        tree.assign(tile_error.size() + 1, 0);
+        for (u32 tile = 0; tile < tile_error.size(); ++tile) Add(tile, Weight(tile));
+    }
+
+    i64 Weight(int tile) const { return active.empty() || active[tile] ? tile_error[tile] : 0; }
+
+    void Add(int tile, i64 delta) {
+        for (int i = tile + 1; i < int(tree.size()); i += i & -i) tree[i] += delta;
+    }
+
+    // returns false if there is no error left to sample from
+    bool Sample(Rng& rng, Vec2u& pixel) const {
+        const i64 total = Total();
+        if (total <= 0) return false;
+        // descend the tree to the tile containing the target weight
+        i64 target = rng.Below(total);
+        int tile = 0;
+        for (int step = top_bit; step > 0; step /= 2) {
+            if (tile + step < int(tree.size()) && tree[tile + step] <= target) {
+                tile += step;
+                target -= tree[tile];
+            }
+        }
+        const int tx = tile % tiles_x, ty = tile / tiles_x;
+        pixel.x = rng.Int(tx * tile_size, std::min(width, (tx + 1) * tile_size) - 1);
+        pixel.y = rng.Int(ty * tile_size, std::min(height, (ty + 1) * tile_size) - 1);
+        return true;
+    }
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "geometry.hpp"
+#include "pipeline.hpp"
+#include "source.hpp"
+#include "trace.hpp"
+
+// Destination of the evolved frames. Frames arrive in order from a single thread, backends open lazily on the first
+// frame since the frame size is not known before.
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    // Returns false if this or an earlier frame could not be written. The sink is done with frame once this returns,
+    // the caller reuses it for the next frame.
+    virtual bool Write(u32 index, const cv::Mat& frame) = 0;
+
+    // flushes pending frames, returns false if any frame could not be written
+    virtual bool Close() { return !failed; }
+
+protected:
+    bool failed = false;
+};
+
+// Encodes into a container through cv::VideoWriter
+class VideoWriterSink : public FrameSink {
+public:
+    VideoWriterSink(std::string path, int fourcc, double fps) : path(std::move(path)), fourcc(fourcc), fps(fps) {}
+
+    bool Write(u32, const cv::Mat& frame) override {
+        if (failed) return false;
+        if (!writer.isOpened() && !writer.open(path, fourcc, fps, frame.size())) {
+            printf("Failed to open video writer for %s\n", path.c_str());
+            failed = true;
+            return false;
+        }
+        writer.write(frame);
+        return true;
+    }
+
+    bool Close() override {
+        writer.release();
+        return !failed;
+    }
+
+private:
+    std::string path;
+    int fourcc;
+    double fps;
+    cv::VideoWriter writer;
+};
+
+// Streams uncompressed 4:4:4 YUV4MPEG2 to a file or to stdout ("-"), e.g. to pipe into ffmpeg. For stdout the
+// original descriptor is kept for the stream and stdout itself is redirected to stderr, so log output does not end up
+// in the video.
+class Y4mSink : public FrameSink {
+public:
+    Y4mSink(const std::string& path, double fps) : fps(fps) {
+        if (path == "-") {
+            fflush(stdout);
+            const int fd = dup(STDOUT_FILENO);
+            if (fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0) file = fdopen(fd, "wb");
+        } else {
+            file = fopen(path.c_str(), "wb");
+        }
+        if (!file) {
+            printf("Failed to open Y4M output %s\n", path.c_str());
+            failed = true;
+        }
+    }
+
+    ~Y4mSink() override { Close(); }
+
+    bool Write(u32, const cv::Mat& frame) override {
+        if (failed) return false;
+        if (size.empty()) {
+            size = frame.size();
+            // frame rate as a fraction in thousandths, full range BT.601 since that is what COLOR_BGR2YCrCb produces
+            fprintf(file, "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C444 XCOLORRANGE=FULL\n", size.width, size.height,
+                    std::lround(fps * 1000));
+        }
+        if (frame.size() != size) {
+            printf("Y4M frame size changed from %dx%d to %dx%d\n", size.width, size.height, frame.cols, frame.rows);
+            failed = true;
+            return false;
+        }
+
+        cv::cvtColor(frame, yuv, cv::COLOR_BGR2YCrCb);
+        cv::split(yuv, planes);
+        fputs("FRAME\n", file);
+        // Y4M stores the planes as Y, Cb, Cr
+        for (int index : {0, 2, 1}) {
+            const cv::Mat& plane = planes[index];
+            for (int y = 0; y < plane.rows; ++y) {
+                if (fwrite(plane.ptr(y), 1, plane.cols, file) != size_t(plane.cols)) failed = true;
+            }
+        }
+        return !failed;
+    }
+
+    bool Close() override {
+        if (file) {
+            if (fclose(file) != 0) failed = true;
+            file = nullptr;
+        }
+        return !failed;
+    }
+
+private:
+    double fps;
+    FILE* file = nullptr;
+    cv::Size size;
+    // reused between frames
+    cv::Mat yuv, planes[3];
+};
+
+// Writes one image per frame as "out<index><suffix>". Encoding and file I/O run on a writer thread, which gets a
+// copy of the frame in a pooled buffer, the caller only blocks once the queue is full.
+class ImageSequenceSink : public FrameSink {
+public:
+    explicit ImageSequenceSink(std::string suffix) : suffix(std::move(suffix)), queue(queue_capacity) {
+        writer = std::thread([this]() {
+            TRACE_THREAD("imwrite");
+            for (auto item = queue.Pop(); item.second != end_marker; item = queue.Pop()) {
+                TRACE_SCOPE("imwrite");
+                std::string frame_name = "out" + std::to_string(item.first) + this->suffix;
+                if (!cv::imwrite(frame_name, pool->Frame(item.second))) {
+                    printf("Failed to write %s\n", frame_name.c_str());
+                    write_failed = true;
+                }
+                pool->Release(item.second);
+            }
+        });
+    }
+
+    ~ImageSequenceSink() override { Close(); }
+
+    bool Write(u32 index, const cv::Mat& frame) override {
+        if (write_failed || failed) return false;
+        if (!pool) {
+            // a full queue, the frame being written and the one being copied
+            pool = std::make_unique<FramePool>(queue_capacity + 2, frame.cols, frame.rows);
+            size = frame.size();
+        }
+        if (frame.size() != size) {
+            printf("Image sequence frame size changed from %dx%d to %dx%d\n", size.width, size.height, frame.cols,
+                   frame.rows);
+            failed = true;
+            return false;
+        }
+        const u32 buffer = pool->Acquire();
+        cv::Mat copy = pool->Frame(buffer);
+        frame.copyTo(copy);
+        queue.Push({index, buffer});
+        return true;
+    }
+
+    bool Close() override {
+        if (writer.joinable()) {
+            queue.Push({0, end_marker});
+            writer.join();
+        }
+        return !write_failed && !failed;
+    }
+
+private:
+    static constexpr u32 queue_capacity = 8;
+    static constexpr u32 end_marker = ~0u;
+
+    std::string suffix;
+    // the writer thread releases the buffers of the pool, the pool exists before the first frame gets queued
+    std::unique_ptr<FramePool> pool;
+    cv::Size size;
+    // frame index and pool buffer
+    SpscQueue<std::pair<u32, u32>> queue;
+    std::atomic<bool> write_failed{false};
+    std::thread writer;
+};
+
+// output selects the backend: empty for an image sequence named after the source, "-" or a .y4m path for Y4M and
+// any other path for a container written by cv::VideoWriter, with the codec picked by the extension
+inline std::unique_ptr<FrameSink> CreateFrameSink(const std::string& output, const std::string& source_path,
+                                                  double fps) {
+    auto EndsWith = [&](const char* extension) {
+        const std::string ext(extension);
+        return output.size() >= ext.size() && output.compare(output.size() - ext.size(), ext.size(), ext) == 0;
+    };
+
+    if (output.empty()) {
+        const u64 start_name = source_path.find_last_of('/');
+        return std::make_unique<ImageSequenceSink>(
+            "_" + source_path.substr(start_name == std::string::npos ? 0 : start_name) + ".bmp");
+    }
+    if (output == "-" || EndsWith(".y4m")) return std::make_unique<Y4mSink>(output, fps);
+    const int fourcc = EndsWith(".avi") ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G')
+                                        : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+    return std::make_unique<VideoWriterSink>(output, fourcc, fps);
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "pipeline.hpp"
+#include "trace.hpp"
+
+// Fixed set of aligned frame buffers that get recycled instead of allocating a cv::Mat per frame. One thread
+// acquires buffers and one other releases them, so the free list is a single producer single consumer queue and an
+// empty pool blocks the acquiring thread until a frame is done.
+class FramePool {
+public:
+    static constexpr u32 alignment = 64;
+
+    FramePool(u32 count, int width, int height) : width(width), height(height), free(count) {
+        const u64 bytes = (u64(width) * height * 3 + alignment - 1) / alignment * alignment;
+        for (u32 i = 0; i < count; ++i) {
+            buffers.emplace_back(static_cast<u8*>(std::aligned_alloc(alignment, bytes)), std::free);
+            free.Push(i);
+        }
+    }
+
+    u32 Acquire() { return free.Pop(); }
+
+    void Release(u32 buffer) { free.Push(buffer); }
+
+    // BGR frame header over a buffer, valid until the buffer is released
+    cv::Mat Frame(u32 buffer) { return cv::Mat(height, width, CV_8UC3, buffers[buffer].get()); }
+
+private:
+    int width, height;
+    std::vector<std::unique_ptr<u8, decltype(&std::free)>> buffers;
+    SpscQueue<u32> free;
+};
+
+// Sequence of BGR frames, downsampled by scale on the way in
+class FrameSource {
+public:
+    virtual ~FrameSource() = default;
+
+    // reads the next frame into frame, which must be Width() x Height() CV_8UC3, returns false at the end
+    virtual bool Read(cv::Mat& frame) = 0;
+
+    bool IsOpen() const { return open; }
+    int Width() const { return width / scale; }
+    int Height() const { return height / scale; }
+    double Fps() const { return fps; }
+
+protected:
+    explicit FrameSource(int scale) : scale(scale) {}
+
+    // brings a full resolution frame down to the size of frame
+    void Downsample(const cv::Mat& full, cv::Mat& frame) {
+        TRACE_SCOPE("resize");
+        if (scale > 1) {
+            cv::resize(full, frame, frame.size());
+        } else {
+            full.copyTo(frame);
+        }
+    }
+
+    int scale;
+    bool open = false;
+    int width = 0, height = 0;
+    double fps = 30;
+};
+
+// Any file or stream OpenCV can decode
+class CaptureSource : public FrameSource {
+public:
+    CaptureSource(const std::string& path, int scale) : FrameSource(scale), capture(path) {
+        open = capture.isOpened();
+        if (!open) return;
+        width = capture.get(cv::CAP_PROP_FRAME_WIDTH);
+        height = capture.get(cv::CAP_PROP_FRAME_HEIGHT);
+        const double capture_fps = capture.get(cv::CAP_PROP_FPS);
+        if (capture_fps > 0) fps = capture_fps;
+    }
+
+    bool Read(cv::Mat& frame) override {
+        // the decoder owns its output, so this is the one copy left on this path
+        if (!capture.read(full) || full.empty()) return false;
+        Downsample(full, frame);
+        return true;
+    }
+
+private:
+    cv::VideoCapture capture;
+    cv::Mat full;
+};
+
+// Uncompressed frames from stdin ("-"), a file or a FIFO, e.g. piped from ffmpeg. Either YUV4MPEG2 with 4:2:0 or
+// 4:4:4 chroma, or headerless rawvideo in bgr24 of a known size. Both chroma layouts are BT.601 Y'CbCr in the range
+// the XCOLORRANGE tag names, limited if there is none. Rawvideo at scale 1 is read straight into the frame.
+class RawSource : public FrameSource {
+public:
+    // width and height are only used for rawvideo, y4m takes them from its header
+    RawSource(const std::string& path, bool y4m, int width, int height, double fps, int scale)
+        : FrameSource(scale), y4m(y4m) {
+        file = path == "-" ? stdin : fopen(path.c_str(), "rb");
+        if (!file) {
+            printf("Failed to open %s\n", path.c_str());
+            return;
+        }
+        this->width = width;
+        this->height = height;
+        this->fps = fps;
+        open = y4m ? ReadHeader() : width > 0 && height > 0;
+        if (!open) return;
+
+        if (y4m && chroma420) {
+            // I420 layout, all planes in one buffer
+            staging.create(this->height * 3 / 2, this->width, CV_8UC1);
+        } else if (y4m) {
+            staging.create(this->height * 3, this->width, CV_8UC1);
+        } else if (scale > 1) {
+            staging.create(this->height, this->width, CV_8UC3);
+        }
+    }
+
+    ~RawSource() override {
+        if (file && file != stdin) fclose(file);
+    }
+
+    bool Read(cv::Mat& frame) override {
+        if (y4m && !ReadFrameHeader()) return false;
+
+        if (!y4m && scale == 1) {
+            // bgr24 at full size is already the frame, it gets read into place
+            for (int y = 0; y < frame.rows; ++y) {
+                if (!ReadBytes(frame.ptr(y), u64(frame.cols) * 3)) return false;
+            }
+            return true;
+        }
+        if (!ReadBytes(staging.data, staging.total() * staging.elemSize())) return false;
+        if (!y4m) {
+            Downsample(staging, frame);
+            return true;
+        }
+
+        cv::Mat& bgr = scale > 1 ? full : frame;
+        ConvertYCbCr(bgr);
+        if (scale > 1) Downsample(full, frame);
+        return true;
+    }
+
+private:
+    // Planes of the staging buffer to BGR with the BT.601 matrix in 16.16 fixed point, for both chroma layouts. A
+    // 4:2:0 chroma sample covers 2x2 pixels. Limited range gets stretched from 16..235 luma and 16..240 chroma.
+    void ConvertYCbCr(cv::Mat& bgr) {
+        bgr.create(height, width, CV_8UC3);
+        const int shift = chroma420 ? 1 : 0;
+        const int chroma_width = width >> shift;
+        const u8* luma = staging.data;
+        const u8* cb_plane = luma + u64(width) * height;
+        const u8* cr_plane = cb_plane + u64(chroma_width) * (height >> shift);
+        const double luma_scale = full_range ? 1.0 : 255.0 / 219, chroma_scale = full_range ? 1.0 : 255.0 / 224;
+        const int luma_offset = full_range ? 0 : 16;
+        const int ky = std::lround(65536 * luma_scale);
+        const int kr = std::lround(65536 * 1.402 * chroma_scale), kb = std::lround(65536 * 1.772 * chroma_scale);
+        const int kgb = std::lround(65536 * 0.344136 * chroma_scale);
+        const int kgr = std::lround(65536 * 0.714136 * chroma_scale);
+        #pragma omp parallel for
+        for (int y = 0; y < height; ++y) {
+            const u8* luma_row = luma + u64(y) * width;
+            const u8* cb_row = cb_plane + u64(y >> shift) * chroma_width;
+            const u8* cr_row = cr_plane + u64(y >> shift) * chroma_width;
+            u8* row = bgr.ptr(y);
+            for (int x = 0; x < width; ++x) {
+                const int l = (luma_row[x] - luma_offset) * ky + 32768;
+                const int cb = cb_row[x >> shift] - 128, cr = cr_row[x >> shift] - 128;
+                row[x * 3] = std::clamp((l + kb * cb) >> 16, 0, 255);
+                row[x * 3 + 1] = std::clamp((l - kgb * cb - kgr * cr) >> 16, 0, 255);
+                row[x * 3 + 2] = std::clamp((l + kr * cr) >> 16, 0, 255);
+            }
+        }
+    }
+
+    bool ReadBytes(u8* data, u64 count) { return fread(data, 1, count, file) == count; }
+
+    // reads one header line without the newline, false at the end of the stream
+    bool ReadLine(std::string& line) {
+        line.clear();
+        for (int c = fgetc(file); c != '\n'; c = fgetc(file)) {
+            if (c == EOF) return false;
+            line.push_back(char(c));
+        }
+        return true;
+    }
+
+    bool ReadHeader() {
+        std::string line;
+        if (!ReadLine(line) || line.compare(0, 10, "YUV4MPEG2 ") != 0) {
+            printf("Input is not a YUV4MPEG2 stream\n");
+            return false;
+        }
+        std::string colorspace = "420jpeg";
+        for (u64 start = 10; start < line.size();) {
+            u64 end = line.find(' ', start);
+            if (end == std::string::npos) end = line.size();
+            const std::string token = line.substr(start, end - start);
+            if (token.size() > 1) {
+                const std::string value = token.substr(1);
+                if (token[0] == 'W') width = std::atoi(value.c_str());
+                if (token[0] == 'H') height = std::atoi(value.c_str());
+                if (token[0] == 'C') colorspace = value;
+                if (token == "XCOLORRANGE=FULL") full_range = true;
+                if (token[0] == 'F') {
+                    int num = 0, den = 0;
+                    if (sscanf(value.c_str(), "%d:%d", &num, &den) == 2 && num > 0 && den > 0) fps = double(num) / den;
+                }
+            }
+            start = end + 1;
+        }
+
+        chroma420 = colorspace.compare(0, 3, "420") == 0;
+        if (!chroma420 && colorspace != "444") {
+            printf("Unsupported Y4M colorspace %s, use 420 or 444\n", colorspace.c_str());
+            return false;
+        }
+        if (width <= 0 || height <= 0 || (chroma420 && (width % 2 || height % 2))) {
+            printf("Unsupported Y4M frame size %dx%d\n", width, height);
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadFrameHeader() {
+        std::string line;
+        if (!ReadLine(line)) return false;
+        if (line.compare(0, 5, "FRAME") != 0) {
+            printf("Invalid Y4M frame header\n");
+            return false;
+        }
+        return true;
+    }
+
+    FILE* file = nullptr;
+    bool y4m;
+    bool chroma420 = false;
+    bool full_range = false;
+    // reused between frames, rawvideo without downsampling needs neither
+    cv::Mat staging, full;
+};
+
+// input selects the source: "file" decodes path with OpenCV, "y4m" and "raw" read uncompressed frames from path,
+// with "-" for stdin. Returns nullptr if the source could not be opened.
+inline std::unique_ptr<FrameSource> CreateFrameSource(const std::string& input, const std::string& path,
+                                                      int raw_width, int raw_height, double raw_fps, int scale) {
+    std::unique_ptr<FrameSource> source;
+    if (input == "file") {
+        source = std::make_unique<CaptureSource>(path, scale);
+    } else {
+        source = std::make_unique<RawSource>(path, input == "y4m", raw_width, raw_height, raw_fps, scale);
+    }
+    if (!source->IsOpen()) return nullptr;
+    return source;
+}
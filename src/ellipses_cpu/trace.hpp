@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+
+// Scoped phase tracing into per thread ring buffers, exported in the Chrome trace event format (chrome://tracing,
+// ui.perfetto.dev). Only compiled in with IMAGE_EVO_TRACE=1 (cmake -DIMAGE_EVO_TRACE=ON), otherwise TRACE_SCOPE and
+// TRACE_THREAD expand to nothing. Recording an event takes two clock reads and a store into the ring of the calling
+// thread, without any lock or shared cache line.
+#ifndef IMAGE_EVO_TRACE
+#define IMAGE_EVO_TRACE 0
+#endif
+
+constexpr bool trace_enabled = IMAGE_EVO_TRACE;
+
+struct TraceEvent {
+    // string literal
+    const char* name;
+    u64 start_ns, end_ns;
+};
+
+// Last capacity events of one thread. Only the owning thread writes, the export reads once the writers are idle.
+class TraceRing {
+public:
+    static constexpr u32 capacity = 1 << 16;
+
+    explicit TraceRing(u32 thread) : thread(thread), events(capacity) {}
+
+    void Add(const char* name, u64 start_ns, u64 end_ns) {
+        const u64 index = head.load(std::memory_order_relaxed);
+        events[index % capacity] = {name, start_ns, end_ns};
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    u32 thread;
+    std::string name;
+    std::vector<TraceEvent> events;
+    // events ever added, the ring holds the last capacity of them
+    std::atomic<u64> head{0};
+};
+
+// Owns the rings of all threads, so they outlive the threads that wrote them
+class Tracer {
+public:
+    static Tracer& Get() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // ring of the calling thread, registered on its first event
+    TraceRing& Ring() {
+        thread_local TraceRing* ring = Register();
+        return *ring;
+    }
+
+    u64 Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    bool WriteChromeTrace(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file) return false;
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+        bool first = true;
+        for (const auto& ring : rings) {
+            const std::string name = ring->name.empty() ? "thread " + std::to_string(ring->thread) : ring->name;
+            fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                    "\"args\": {\"name\": \"%s\"}}", first ? "" : ",", ring->thread, name.c_str());
+            first = false;
+            const u64 head = ring->head.load(std::memory_order_acquire);
+            for (u64 i = head > TraceRing::capacity ? head - TraceRing::capacity : 0; i < head; ++i) {
+                const TraceEvent& event = ring->events[i % TraceRing::capacity];
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+                        "\"dur\": %.3f}",
+                        event.name, ring->thread, event.start_ns * 1e-3, (event.end_ns - event.start_ns) * 1e-3);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+
+private:
+    TraceRing* Register() {
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(std::make_unique<TraceRing>(rings.size()));
+        return rings.back().get();
+    }
+
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+};
+
+// Records the lifetime of the scope as one event
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), start_ns(Tracer::Get().Now()) {}
+
+    ~TraceScope() { Tracer::Get().Ring().Add(name, start_ns, Tracer::Get().Now()); }
+
+private:
+    const char* name;
+    u64 start_ns;
+};
+
+// Writes the trace when it goes out of scope, after the threads of the run have been joined
+class ChromeTraceDump {
+public:
+    explicit ChromeTraceDump(std::string path) : path(std::move(path)) {}
+
+    ~ChromeTraceDump() {
+        if (!path.empty() && !Tracer::Get().WriteChromeTrace(path)) {
+            printf("Failed to write trace to %s\n", path.c_str());
+        }
+    }
+
+private:
+    std::string path;
+};
+
+#if IMAGE_EVO_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// traces the rest of the enclosing scope, name must be a string literal
+#define TRACE_SCOPE(name) const TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+// names the calling thread in the trace
+#define TRACE_THREAD(thread_name) (Tracer::Get().Ring().name = (thread_name))
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD(thread_name) ((void)0)
+#endif
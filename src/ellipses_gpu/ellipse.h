@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ellipse_form.hpp"
+
 using u8 = unsigned char;
 using u16 = unsigned short;
 using u32 = unsigned int;
@@ -12,9 +14,10 @@ struct FitCalcResult {
 void AllocBuffer(void** pointer, u32 size);
 void FreeBuffer(void** pointer);
 
+// the coverage of both kernels is defined by EllipseForm::Contains, the form gets set up on the host
 void DrawEllipseGPU(u8* buffer, u32 size, int width, int height, u32 origin_x, u32 origin_y,
-                    int major, int minor, double angle, u8* image);
+                    const EllipseForm& form, u8* image);
 
 void CalcFitnessGPU(u8* buffer, u32 size, int width, int height, u32 origin_x,
-                    u32 origin_y,int major, int minor, double angle, u32 color,
+                    u32 origin_y, const EllipseForm& form, u32 color,
                     u8* image, u8* new_gen, FitCalcResult* result);
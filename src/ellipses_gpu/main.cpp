@@ -42,7 +42,8 @@ void NextGeneration(int width, int height, u8* scratch_buffer, u8* out_buffer, u
     Ellipse best_fit = e;
 
     while (current_mutation < 500) {
-        CalcFitnessGPU(out_buffer, size, width, height, e.origin.x, e.origin.y, e.major, e.minor, e.angle,
+        const EllipseForm form = EllipseForm::Create(e.major, e.minor, e.angle);
+        CalcFitnessGPU(out_buffer, size, width, height, e.origin.x, e.origin.y, form,
                        e.color.ToU32(), original, scratch_buffer, result);
 
         result->new_score /= size;
@@ -50,8 +51,7 @@ void NextGeneration(int width, int height, u8* scratch_buffer, u8* out_buffer, u
 
         if (result->new_score < result->old_score) {
             std::memcpy(scratch_buffer, out_buffer, size);
-            DrawEllipseGPU(scratch_buffer, size, width, height, e.origin.x, e.origin.y, e.major, e.minor,
-                           e.angle, original);
+            DrawEllipseGPU(scratch_buffer, size, width, height, e.origin.x, e.origin.y, form, original);
             best_fit = e;
             first_hit = true;
         }
@@ -198,8 +198,8 @@ int main(int argc, char** argv) {
 
         //if (draw_test) {
         //    Ellipse e = RandomEllipse(w, h);
-        //    DrawEllipseGPU(uni_buffer, image.size(), w, h,
-        //                   e.origin.x, e.origin.y, e.major, e.minor, e.angle, image_buffer);
+        //    DrawEllipseGPU(uni_buffer, image.size(), w, h, e.origin.x, e.origin.y,
+        //                   EllipseForm::Create(e.major, e.minor, e.angle), image_buffer);
         //    draw_test = false;
         //    printf("Draw\n");
         //}